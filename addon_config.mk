@@ -6,4 +6,6 @@ meta:
 	ADDON_URL = http://github.com/fieldofview/ofxMapamok
 
 common:
-	ADDON_DEPENDENCIES = ofxOpenCv
+	# the OpenCV-free part lives in the ofxMapamokRuntime addon in this repository,
+	# which playback apps can use on its own
+	ADDON_DEPENDENCIES = ofxOpenCv ofxMapamokRuntime
@@ -0,0 +1,415 @@
+#include "ofMain.h"
+#include "MeshUtils.h"
+#include "ofxMapamokSolver.h"
+#include "DistortionRemap.h"
+#include "ofxMapamokCalibrator.h"
+
+#include <cfloat>
+
+// times the slow parts of ofxMapamok against the code they replaced, or against
+// their single threaded versions, on synthetic data. runs without a window. pass
+// the names of the benchmarks to run, or nothing to run all of them.
+
+// best of a few runs in milliseconds
+template <class F>
+static float timeBest(F f, int runs = 3) {
+	float best = 0;
+	for (int i = 0; i < runs; i++) {
+		uint64_t start = ofGetElapsedTimeMicros();
+		f();
+		float elapsed = (ofGetElapsedTimeMicros() - start) / 1000.;
+		if (i == 0 || elapsed < best) {
+			best = elapsed;
+		}
+	}
+	return best;
+}
+
+// mergeNearbyVertices before the spatial hash, a linear search over the merged vertices
+static ofMesh mergeNearbyVerticesLinear(const ofMesh& mesh, float tolerance) {
+	float squareTolerance = tolerance * tolerance;
+	ofMesh mergedMesh;
+	int n = mesh.getNumVertices();
+	vector<int> remappedIndices;
+	for (int i = 0; i < n; i++) {
+		const ofVec3f& cur = mesh.getVertices()[i];
+		if (mergedMesh.getNumVertices() > 0) {
+			int nearestIndex = findNearestVertex(mergedMesh.getVertices(), cur);
+			const ofVec3f& nearestVertex = mergedMesh.getVertices()[nearestIndex];
+			if (cur.squareDistance(nearestVertex) < squareTolerance) {
+				remappedIndices.push_back(nearestIndex);
+			}
+			else {
+				remappedIndices.push_back(mergedMesh.getNumVertices());
+				mergedMesh.addVertex(cur);
+			}
+		}
+		else {
+			remappedIndices.push_back(0);
+			mergedMesh.addVertex(cur);
+		}
+	}
+	n = mesh.getNumIndices();
+	for (int i = 0; i < n; i++) {
+		mergedMesh.addIndex(remappedIndices[mesh.getIndex(i)]);
+	}
+	return mergedMesh;
+}
+
+// a wavy grid where every quad has its own four corners, like a model exported
+// without shared vertices, with some noise below the merge tolerance
+static ofMesh makeUnweldedGrid(unsigned int vertexCount) {
+	int side = MAX(1, sqrt(vertexCount / 4.));
+	ofMesh mesh;
+	mesh.setMode(OF_PRIMITIVE_TRIANGLES);
+	ofSeedRandom(0);
+	for (int y = 0; y < side; y++) {
+		for (int x = 0; x < side; x++) {
+			ofIndexType first = mesh.getNumVertices();
+			for (int corner = 0; corner < 4; corner++) {
+				float cx = x + (corner & 1), cy = y + (corner >> 1);
+				ofVec3f noise(ofRandom(-1, 1), ofRandom(-1, 1), ofRandom(-1, 1));
+				mesh.addVertex(ofVec3f(cx, cy, sin(cx * .1) * cos(cy * .1) * 10) + noise * .001);
+			}
+			mesh.addTriangle(first, first + 1, first + 3);
+			mesh.addTriangle(first, first + 3, first + 2);
+		}
+	}
+	return mesh;
+}
+
+static void benchmarkMerge() {
+	const float tolerance = .01;
+	// the linear search takes minutes above this
+	const unsigned int maxLinearVertices = 100000;
+	unsigned int sizes[] = { 10000, 100000, 400000, 1000000, 5000000 };
+	cout << "mergeNearbyVertices, ms" << endl;
+	cout << "vertices\tmerged\tlinear\thash\thash threaded\tspeedup" << endl;
+	for (unsigned int size : sizes) {
+		ofMesh mesh = makeUnweldedGrid(size);
+		ofMesh merged;
+		float single = timeBest([&] { merged = mergeNearbyVertices(mesh, tolerance, false); });
+		float threaded = timeBest([&] { mergeNearbyVertices(mesh, tolerance, true); });
+		cout << mesh.getNumVertices() << "\t" << merged.getNumVertices() << "\t";
+		if (mesh.getNumVertices() <= maxLinearVertices) {
+			ofMesh linearMerged;
+			float linear = timeBest([&] { linearMerged = mergeNearbyVerticesLinear(mesh, tolerance); }, 1);
+			bool same = linearMerged.getVertices() == merged.getVertices() && linearMerged.getIndices() == merged.getIndices();
+			cout << linear << "\t" << single << "\t" << threaded << "\t" << linear / threaded << "x" << (same ? "" : " different result!") << endl;
+		}
+		else {
+			cout << "-\t" << single << "\t" << threaded << "\t-" << endl;
+		}
+	}
+	cout << endl;
+}
+
+// a camera looking at the grid from above, like the calibrator's view of a model
+static void benchmarkProject() {
+	ofRectangle viewport(0, 0, 1920, 1080);
+	unsigned int sizes[] = { 100000, 1000000, 5000000 };
+	cout << "project, ms" << endl;
+	cout << "vertices\tper vertex\tbatch\tbatch threaded\tbatch speedup\tthreaded speedup\tmax difference" << endl;
+	for (unsigned int size : sizes) {
+		ofMesh mesh = makeUnweldedGrid(size);
+		float side = sqrt(size / 4.);
+		ofCamera camera;
+		camera.setPosition(side / 2, -side / 2, side);
+		camera.lookAt(ofVec3f(side / 2, side / 2, 0), ofVec3f(0, 0, 1));
+
+		// project() overwrites the mesh, so every run starts from a copy that is not timed
+		ofMesh projected;
+		float perVertex = 0;
+		for (int i = 0; i < 3; i++) {
+			projected = mesh;
+			uint64_t start = ofGetElapsedTimeMicros();
+			project(projected, camera, viewport);
+			float elapsed = (ofGetElapsedTimeMicros() - start) / 1000.;
+			perVertex = i == 0 ? elapsed : MIN(perVertex, elapsed);
+		}
+
+		PositionBuffer positions, result;
+		positions.setup(mesh.getVertices());
+		float single = timeBest([&] { project(positions, camera, viewport, result, false); });
+		float threaded = timeBest([&] { project(positions, camera, viewport, result, true); });
+
+		float difference = 0;
+		for (unsigned int i = 0; i < result.size(); i++) {
+			ofVec3f expected = projected.getVertices()[i];
+			difference = MAX(difference, expected.distance(ofVec3f(result.x[i], result.y[i], result.z[i])));
+		}
+		cout << mesh.getNumVertices() << "\t" << perVertex << "\t" << single << "\t" << threaded << "\t" << perVertex / single << "x\t" << perVertex / threaded << "x\t" << difference << endl;
+	}
+	cout << endl;
+}
+
+// how many Levenberg-Marquardt iterations calibrateCamera needs from the given
+// seeds, it does not report them, so this solves again with a growing iteration
+// limit until the error matches the one of the default limit of 30
+static int countIterations(const ofxMapamokSolver::Request& request, const cv::Mat1d& cameraMatrix, const cv::Mat& distortionCoefficients) {
+	vector<vector<cv::Point3f> > objectPoints(1, request.objectPoints);
+	vector<vector<cv::Point2f> > imagePoints(1, request.imagePoints);
+	cv::Size imageSize(request.viewport.width, request.viewport.height);
+	vector<cv::Mat> rvecs, tvecs;
+	auto calibrate = [&](int iterations) {
+		cv::Mat1d camera = cameraMatrix.clone();
+		cv::Mat distortion = distortionCoefficients.clone();
+		cv::TermCriteria criteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, iterations, DBL_EPSILON);
+		return cv::calibrateCamera(objectPoints, imagePoints, imageSize, camera, distortion, rvecs, tvecs, request.flags, criteria);
+	};
+	double converged = calibrate(30);
+	for (int iterations = 1; iterations < 30; iterations++) {
+		if (fabs(calibrate(iterations) - converged) <= 1e-9 * MAX(1., converged)) {
+			return iterations;
+		}
+	}
+	return 30;
+}
+
+// random points in front of a 1920x1080 projector with a little k1, and where it sees them
+static void makeCorrespondences(unsigned int count, vector<cv::Point3f>& objectPoints, vector<cv::Point2f>& imagePoints) {
+	cv::Mat1d cameraMatrix = (cv::Mat1d(3, 3) <<
+		1500, 0, 960,
+		0, 1500, 540,
+		0, 0, 1);
+	cv::Mat1d distortionCoefficients = (cv::Mat1d(1, 5) << -.05, 0, 0, 0, 0);
+	cv::Mat1d rvec = (cv::Mat1d(3, 1) << .1, -.2, .05), tvec = (cv::Mat1d(3, 1) << .5, -.3, 10);
+	ofSeedRandom(0);
+	objectPoints.clear();
+	for (unsigned int i = 0; i < count; i++) {
+		objectPoints.push_back(cv::Point3f(ofRandom(-3, 3), ofRandom(-3, 3), ofRandom(-3, 3)));
+	}
+	cv::projectPoints(objectPoints, rvec, tvec, cameraMatrix, distortionCoefficients, imagePoints);
+}
+
+// a projector looking at random points, and a drag of one image point by a pixel per
+// solve, like moving a point in the calibrator. every step is solved from the angle of
+// view and from the previous solution
+static void benchmarkSolve() {
+	const int steps = 20;
+	ofRectangle viewport(0, 0, 1920, 1080);
+	vector<cv::Point3f> objectPoints;
+	vector<cv::Point2f> imagePoints;
+	makeCorrespondences(30, objectPoints, imagePoints);
+
+	struct Case {
+		string name;
+		int flags;
+	};
+	int fixIntrinsics = CV_CALIB_FIX_FOCAL_LENGTH | CV_CALIB_FIX_PRINCIPAL_POINT;
+	vector<Case> cases = {
+		{ "no distortion", CV_CALIB_USE_INTRINSIC_GUESS | ofxMapamokSolver::distortionFlags },
+		{ "k1", CV_CALIB_USE_INTRINSIC_GUESS | CV_CALIB_FIX_K2 | CV_CALIB_FIX_K3 | CV_CALIB_ZERO_TANGENT_DIST },
+		// the intrinsics stay at the angle of view guess, which is not the 1500 px
+		// focal length of the points, so both rms are large and only the times compare
+		{ "pose only", CV_CALIB_USE_INTRINSIC_GUESS | fixIntrinsics | ofxMapamokSolver::distortionFlags }
+	};
+	cout << "solve, " << steps << " steps of a one pixel drag, mean per solve" << endl;
+	cout << "flags\tcold ms\twarm ms\tspeedup\tcold iterations\twarm iterations\tcold rms\twarm rms" << endl;
+	for (auto const& c : cases) {
+		ofxMapamokSolver::Request request;
+		request.viewport = viewport;
+		request.objectPoints = objectPoints;
+		request.imagePoints = imagePoints;
+		request.flags = c.flags;
+		// the solution before the drag, like the one the calibrator already has
+		request.warmStart = ofxMapamokSolver::solve(request);
+
+		float coldTime = 0, warmTime = 0, coldRms = 0, warmRms = 0;
+		int coldIterations = 0, warmIterations = 0;
+		for (int step = 0; step < steps; step++) {
+			request.imagePoints[0].x += 1;
+			ofxMapamokSolver::Request coldRequest = request;
+			coldRequest.warmStart = ofxMapamokSolver::Solution();
+			ofxMapamokSolver::Solution cold = ofxMapamokSolver::solve(coldRequest);
+			ofxMapamokSolver::Solution warm = ofxMapamokSolver::solve(request);
+			coldTime += cold.solveTime;
+			warmTime += warm.solveTime;
+			coldRms += cold.rms;
+			warmRms += warm.rms;
+			if (!warm.poseOnly) {
+				// the seeds solve() starts from
+				float f = viewport.width * ofDegToRad(request.aov);
+				cv::Mat1d coldCameraMatrix = (cv::Mat1d(3, 3) <<
+					f, 0, viewport.width / 2,
+					0, f, viewport.height / 2,
+					0, 0, 1);
+				coldIterations += countIterations(request, coldCameraMatrix, cv::Mat());
+				warmIterations += countIterations(request, request.warmStart.cameraMatrix, request.warmStart.distortionCoefficients);
+			}
+			request.warmStart = warm;
+		}
+		cout << c.name << "\t" << coldTime / steps << "\t" << warmTime / steps << "\t" << coldTime / warmTime << "x\t";
+		if (coldIterations > 0) {
+			cout << (float) coldIterations / steps << "\t" << (float) warmIterations / steps;
+		}
+		else {
+			// solvePnP does not report its iterations either, and has no limit to vary
+			cout << "-\t-";
+		}
+		cout << "\t" << coldRms / steps << "\t" << warmRms / steps << endl;
+	}
+	cout << endl;
+}
+
+// the shader's lookup done per pixel in float, without a table
+static void remapDirect(const LensDistortion& distortion, const ofPixels& src, ofPixels& dst) {
+	int width = src.getWidth(), height = src.getHeight();
+	const unsigned char* in = src.getData();
+	unsigned char* out = dst.getData();
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			ofVec2f texCoord = distortion.getTexCoord(ofVec2f(x + .5f, y + .5f));
+			float u = ofClamp(texCoord.x - .5f, 0, width - 1);
+			float v = ofClamp(texCoord.y - .5f, 0, height - 1);
+			int x0 = MIN((int) u, width - 2), y0 = MIN((int) v, height - 2);
+			float fx = u - x0, fy = v - y0;
+			const unsigned char* top = in + ((size_t) y0 * width + x0) * 4;
+			const unsigned char* bottom = top + (size_t) width * 4;
+			for (int c = 0; c < 4; c++) {
+				float upper = top[c] + (top[c + 4] - top[c]) * fx;
+				float lower = bottom[c] + (bottom[c + 4] - bottom[c]) * fx;
+				*out++ = upper + (lower - upper) * fy + .5f;
+			}
+		}
+	}
+}
+
+static void benchmarkRemap() {
+	struct ImageSize {
+		int width, height;
+	};
+	ImageSize sizes[] = { { 1280, 720 }, { 1920, 1080 }, { 3840, 2160 } };
+#if defined(__AVX2__)
+	string simd = "avx2";
+#elif defined(__SSE2__) || defined(_M_X64)
+	string simd = "sse2";
+#else
+	string simd = "scalar";
+#endif
+	cout << "DistortionRemap, " << simd << " build, megapixels per second" << endl;
+	cout << "size\tsetup ms\tdirect\tremap\tremap threaded\tspeedup\tmax difference" << endl;
+	for (auto const& size : sizes) {
+		LensDistortion distortion;
+		distortion.setup(ofVec3f(-.15, .05, -.01), ofVec2f(.001, -.002), ofVec2f(size.width, size.width), ofVec2f(size.width / 2, size.height / 2));
+		ofPixels src, reference, dst;
+		src.allocate(size.width, size.height, 4);
+		reference.allocate(size.width, size.height, 4);
+		dst.allocate(size.width, size.height, 4);
+		ofSeedRandom(0);
+		for (size_t i = 0; i < (size_t) size.width * size.height * 4; i++) {
+			src.getData()[i] = ofRandom(256);
+		}
+
+		DistortionRemap remap;
+		float setup = timeBest([&] { remap.setup(distortion, size.width, size.height); }, 1);
+		float direct = timeBest([&] { remapDirect(distortion, src, reference); }, 1);
+		float single = timeBest([&] { remap.remap(src, dst, false); });
+		float threaded = timeBest([&] { remap.remap(src, dst, true); });
+		// the table rounds the weights to 8 bit, so a few levels are expected
+		int difference = 0;
+		for (size_t i = 0; i < (size_t) size.width * size.height * 4; i++) {
+			difference = MAX(difference, abs(reference.getData()[i] - dst.getData()[i]));
+		}
+		// megapixels per second from milliseconds
+		float megapixels = size.width * size.height / 1e6;
+		auto throughput = [&](float milliseconds) { return megapixels / (milliseconds / 1000); };
+		cout << size.width << "x" << size.height << "\t" << setup << "\t" << throughput(direct) << "\t" << throughput(single) << "\t" << throughput(threaded) << "\t" << direct / threaded << "x\t" << difference << endl;
+	}
+	cout << endl;
+}
+
+// startup loads of a calibration folder: calibration.yml and pointdata.yml through
+// cv::FileStorage like ofxMapamok::load() and ofxMapamokCalibrator::load(), against
+// the calibration.bin convertToBinary() makes from them. the files are read from
+// the disk cache after the first run, which is the case for a show that restarts
+static void benchmarkLoad() {
+	unsigned int sizes[] = { 100, 10000, 100000 };
+	string folder = ofToDataPath("benchmark/", true);
+	ofDirectory::createDirectory(folder, false, true);
+	cout << "calibration loading, ms" << endl;
+	cout << "points\tyml\tbin\tspeedup" << endl;
+	for (unsigned int size : sizes) {
+		vector<cv::Point3f> objectPoints;
+		vector<cv::Point2f> imagePoints;
+		makeCorrespondences(size, objectPoints, imagePoints);
+		vector<int> pointIndices(size);
+		for (unsigned int i = 0; i < size; i++) {
+			pointIndices[i] = i;
+		}
+
+		// ofxMapamok only saves a solved calibration
+		ofxMapamok saved;
+		vector<cv::Point2f> fewImagePoints(imagePoints.begin(), imagePoints.begin() + 30);
+		vector<cv::Point3f> fewObjectPoints(objectPoints.begin(), objectPoints.begin() + 30);
+		saved.calibrate(ofRectangle(0, 0, 1920, 1080), fewImagePoints, fewObjectPoints, CV_CALIB_USE_INTRINSIC_GUESS | ofxMapamokSolver::distortionFlags);
+		saved.save(folder + "calibration.yml");
+		{
+			cv::FileStorage fs(folder + "pointdata.yml", cv::FileStorage::WRITE);
+			fs << "objectPoints" << objectPoints;
+			fs << "imagePoints" << imagePoints;
+			fs << "pointIndices" << pointIndices;
+		}
+		if (!ofxMapamokCalibrator::convertToBinary(folder)) {
+			return;
+		}
+
+		ofxMapamok loaded;
+		vector<cv::Point3f> loadedObjectPoints;
+		vector<cv::Point2f> loadedImagePoints;
+		vector<int> loadedPointIndices;
+		float yml = timeBest([&] {
+			loaded.load(folder + "calibration.yml");
+			cv::FileStorage fs(folder + "pointdata.yml", cv::FileStorage::READ);
+			fs["objectPoints"] >> loadedObjectPoints;
+			fs["imagePoints"] >> loadedImagePoints;
+			fs["pointIndices"] >> loadedPointIndices;
+		});
+		// the same copies ofxMapamokCalibrator::loadBinary() makes
+		float bin = timeBest([&] {
+			CalibrationFile file;
+			if (!file.open(folder + "calibration.bin")) {
+				return;
+			}
+			loaded.setData(file.getCalibration());
+			unsigned int n = file.getPointCount();
+			const float* object = file.getObjectPoints();
+			const float* image = file.getImagePoints();
+			loadedObjectPoints.resize(n);
+			loadedImagePoints.resize(n);
+			for (unsigned int i = 0; i < n; i++) {
+				loadedObjectPoints[i] = cv::Point3f(object[i * 3], object[i * 3 + 1], object[i * 3 + 2]);
+				loadedImagePoints[i] = cv::Point2f(image[i * 2], image[i * 2 + 1]);
+			}
+			loadedPointIndices.assign(file.getPointIndices(), file.getPointIndices() + n);
+		});
+		cout << size << "\t" << yml << "\t" << bin << "\t" << yml / bin << "x" << endl;
+	}
+	cout << endl;
+}
+
+static bool shouldRun(const vector<string>& names, const string& name) {
+	return names.empty() || ofContains(names, name);
+}
+
+int main(int argc, char** argv) {
+	vector<string> names(argv + 1, argv + argc);
+	// the threaded columns only mean something with more than one
+	cout << ThreadPool::getShared().getNumThreads() << " threads" << endl << endl;
+	if (shouldRun(names, "merge")) {
+		benchmarkMerge();
+	}
+	if (shouldRun(names, "project")) {
+		benchmarkProject();
+	}
+	if (shouldRun(names, "solve")) {
+		benchmarkSolve();
+	}
+	if (shouldRun(names, "remap")) {
+		benchmarkRemap();
+	}
+	if (shouldRun(names, "load")) {
+		benchmarkLoad();
+	}
+	return 0;
+}
@@ -1,49 +1,116 @@
 #pragma once
 #include "ofMain.h"
+#include "FileWatcher.h"
 
+#include <mutex>
+
+// reloads name.vert and name.frag when they change. the files are watched, read
+// and have their #pragma include lines expanded on a FileWatcher thread, so the
+// update event only compiles and links, and only after a change
 class AutoShader : public ofShader {
 public:
+	~AutoShader() {
+		watcher.stop();
+		if(listening) {
+			ofRemoveListener(ofEvents().update, this, &AutoShader::update);
+		}
+	}
+
 	void setup(string name) {
 		this->name = name;
+		readSources();
 		ofEventArgs args;
 		update(args);
-		ofAddListener(ofEvents().update, this, &AutoShader::update);
+		watcher.setup({name + ".vert", name + ".frag"}, [this](const string& path) {
+			readSources();
+		});
+		if(!listening) {
+			ofAddListener(ofEvents().update, this, &AutoShader::update);
+			listening = true;
+		}
 	}
-	
-	void update(ofEventArgs &args) {	
-		bool needsReload = false;
-			
-		string fragName = name + ".frag";
-		ofFile fragFile(fragName);
-		if(fragFile.exists()) {
-			uint64_t fragTimestamp = filesystem::last_write_time(fragFile);
-			if(fragTimestamp != lastFragTimestamp) {
-				needsReload = true;
-				lastFragTimestamp = fragTimestamp;
-			}
-		} else {
-			fragName = "";
-		}
-		
-		string vertName = name + ".vert";
-		ofFile vertFile(vertName);
-		if(vertFile.exists()) {
-			uint64_t vertTimestamp = filesystem::last_write_time(vertFile);
-			if(vertTimestamp != lastVertTimestamp) {
-				needsReload = true;
-				lastVertTimestamp = vertTimestamp;
+
+	void update(ofEventArgs &args) {
+		string vertSource, fragSource;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			if(!sourcesChanged) {
+				return;
 			}
-		} else {
-			vertName = "";
+			vertSource = this->vertSource;
+			fragSource = this->fragSource;
+			sourcesChanged = false;
+		}
+
+		ofLogVerbose("AutoShader") << "reloading shader at " << ofGetTimestampString("%H:%M:%S");
+		unload();
+		if(vertSource != "") {
+			setupShaderFromSource(GL_VERTEX_SHADER, vertSource);
 		}
-		
-		if(needsReload) {
-			ofLogVerbose("AutoShader") << "reloading shader at " << ofGetTimestampString("%H:%M:%S");
-			ofShader::load(vertName, fragName);
+		if(fragSource != "") {
+			setupShaderFromSource(GL_FRAGMENT_SHADER, fragSource);
 		}
+		if(ofIsGLProgrammableRenderer()) {
+			bindDefaults();
+		}
+		linkProgram();
 	}
 
 private:
+	// runs on the watcher thread, except for the first load in setup()
+	void readSources() {
+		string vertSource = readSource(ofToDataPath(name + ".vert", true), 0);
+		string fragSource = readSource(ofToDataPath(name + ".frag", true), 0);
+		std::unique_lock<std::mutex> lock(mutex);
+		this->vertSource = vertSource;
+		this->fragSource = fragSource;
+		sourcesChanged = true;
+	}
+
+	// the file with every #pragma include "file" replaced by that file, relative to the including one
+	static string readSource(const string& path, int depth) {
+		ofFile file(path);
+		if(!file.exists()) {
+			return "";
+		}
+		string source = file.readToBuffer().getText();
+		if(depth > 16) {
+			ofLogError("AutoShader") << "too many nested includes in " << path;
+			return source;
+		}
+
+		string directory = ofFilePath::getEnclosingDirectory(path, false);
+		string expanded;
+		size_t start = 0;
+		while(start < source.size()) {
+			size_t end = source.find('\n', start);
+			if(end == string::npos) {
+				end = source.size();
+			}
+			string line = source.substr(start, end - start);
+			size_t pragma = line.find("#pragma include");
+			size_t open = line.find_first_of("\"<", pragma);
+			size_t close = open == string::npos ? string::npos : line.find_first_of("\">", open + 1);
+			if(pragma != string::npos && close != string::npos) {
+				string included = directory + line.substr(open + 1, close - open - 1);
+				if(!ofFile(included).exists()) {
+					ofLogError("AutoShader") << "could not find " << included << " included from " << path;
+				}
+				expanded += readSource(included, depth + 1) + "\n";
+			} else {
+				expanded += line + "\n";
+			}
+			start = end + 1;
+		}
+		return expanded;
+	}
+
 	string name;
-	uint64_t lastFragTimestamp, lastVertTimestamp;
+	bool listening = false;
+
+	std::mutex mutex;
+	string vertSource, fragSource;
+	bool sourcesChanged = false;
+	// last, so its thread stops before the sources it writes are destroyed
+	FileWatcher watcher;
 };
@@ -0,0 +1,202 @@
+#pragma once
+#include "ofMain.h"
+#include "ofxAssimpUtils.h"
+#include "ofxMapamokCalibrator.h"
+#include "ThreadPool.h"
+
+#include <assimp/Importer.hpp>
+#include <assimp/ProgressHandler.hpp>
+#include <assimp/postprocess.h>
+#include <assimp/scene.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// loads models without blocking the GL thread. a worker thread parses the file
+// with assimp, converts and joins the sub meshes in parallel and prepares the
+// calibrator's merged reference mesh and index, all on its own ThreadPool so the
+// render thread's parallelFor() never runs loader work. the app picks the result
+// up in update() and only then replaces its model, so the previous one stays on
+// screen while loading. a newer load() cancels the one in progress.
+class ModelLoader {
+public:
+	ModelLoader()
+	:requested(0)
+	,stopping(false)
+	,loading(false)
+	,failed(false)
+	,progress(0) {
+		thread = std::thread(&ModelLoader::work, this);
+	}
+	~ModelLoader() {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		condition.notify_all();
+		thread.join();
+	}
+
+	void load(string fileName) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			requestedFileName = ofToDataPath(fileName, true);
+			requested++;
+			loading = true;
+			failed = false;
+			progress = 0;
+			status = "waiting";
+			finishedModel.reset();
+		}
+		condition.notify_all();
+	}
+
+	bool isLoading() const {
+		return loading;
+	}
+	// true when the last load() could not be used, the error is logged
+	bool hasFailed() const {
+		return failed;
+	}
+	// 0 to 1 over the whole load
+	float getProgress() const {
+		return progress;
+	}
+	string getStatus() const {
+		std::unique_lock<std::mutex> lock(mutex);
+		return status;
+	}
+
+	// call from the GL thread, returns the finished model once and null otherwise
+	shared_ptr<ofxMapamokCalibrator::Model> update() {
+		std::unique_lock<std::mutex> lock(mutex);
+		shared_ptr<ofxMapamokCalibrator::Model> model = finishedModel;
+		finishedModel.reset();
+		return model;
+	}
+
+private:
+	// assimp reports its own progress through this, and stops parsing when it returns false
+	class ImportProgress : public Assimp::ProgressHandler {
+	public:
+		ImportProgress(ModelLoader& loader, unsigned int generation)
+		:loader(loader)
+		,generation(generation) {
+		}
+		bool Update(float percentage) {
+			if(percentage >= 0) {
+				loader.setProgress(generation, "parsing", ofClamp(percentage, 0, 1) * parseShare);
+			}
+			return !loader.isSuperseded(generation);
+		}
+	private:
+		ModelLoader& loader;
+		unsigned int generation;
+	};
+
+	// rough share of the total time spent by each stage, for the progress bar
+	static constexpr float parseShare = .6;
+	static constexpr float joinShare = .1;
+
+	void work() {
+		// the merge and the index in prepare() use this pool too
+		ThreadPool::setCurrent(&pool);
+		std::unique_lock<std::mutex> lock(mutex);
+		unsigned int started = 0;
+		while(true) {
+			condition.wait(lock, [&] { return stopping || requested != started; });
+			if(stopping) {
+				break;
+			}
+			started = requested;
+			string fileName = requestedFileName;
+			lock.unlock();
+			shared_ptr<ofxMapamokCalibrator::Model> model = loadModel(fileName, started);
+			lock.lock();
+			if(isSuperseded(started)) {
+				continue;
+			}
+			// a failed load leaves the current model in place
+			finishedModel = model;
+			loading = false;
+			failed = !model;
+			progress = model ? 1 : 0;
+			status = model ? "done" : "failed";
+		}
+	}
+
+	// null when the file can't be loaded or a newer load() came in meanwhile
+	shared_ptr<ofxMapamokCalibrator::Model> loadModel(const string& fileName, unsigned int generation) {
+		if(!ofFile(fileName).exists()) {
+			ofLogError("ModelLoader") << "could not find " << fileName;
+			return nullptr;
+		}
+		setProgress(generation, "parsing", 0);
+		Assimp::Importer importer;
+		// the importer owns and deletes the handler
+		importer.SetProgressHandler(new ImportProgress(*this, generation));
+		// the same post processing ofxAssimpModelLoader::loadModel() does
+		unsigned int flags = aiProcessPreset_TargetRealtime_MaxQuality | aiProcess_Triangulate | aiProcess_FlipUVs;
+		const aiScene* scene = importer.ReadFile(fileName.c_str(), flags);
+		if(isSuperseded(generation)) {
+			return nullptr;
+		}
+		if(scene == NULL) {
+			ofLogError("ModelLoader") << "could not load " << fileName << ": " << importer.GetErrorString();
+			return nullptr;
+		}
+
+		// join all the meshes
+		setProgress(generation, "joining meshes", parseShare);
+		vector<ofMesh> meshes(scene->mNumMeshes);
+		parallelFor(0, meshes.size(), [&](size_t begin, size_t end) {
+			for(size_t i = begin; i < end; i++) {
+				aiMeshToOfMesh(scene->mMeshes[i], meshes[i]);
+			}
+		}, 1);
+		ofMesh mesh;
+		for(auto const& subMesh : meshes) {
+			mesh.append(subMesh);
+		}
+		if(mesh.getNumIndices() == 0) {
+			ofLogError("ModelLoader") << fileName << " has no triangles";
+			return nullptr;
+		}
+
+		if(isSuperseded(generation)) {
+			return nullptr;
+		}
+		setProgress(generation, "merging vertices", parseShare + joinShare);
+		shared_ptr<ofxMapamokCalibrator::Model> model(new ofxMapamokCalibrator::Model());
+		ofxMapamokCalibrator::prepare(mesh, *model);
+		return model;
+	}
+
+	bool isSuperseded(unsigned int generation) const {
+		return stopping || generation != requested;
+	}
+
+	void setProgress(unsigned int generation, string status, float progress) {
+		std::unique_lock<std::mutex> lock(mutex);
+		if(isSuperseded(generation)) {
+			return;
+		}
+		this->status = status;
+		this->progress = progress;
+	}
+
+	mutable std::mutex mutex;
+	std::condition_variable condition;
+	string requestedFileName;
+	std::atomic<unsigned int> requested;
+	std::atomic<bool> stopping;
+	std::atomic<bool> loading;
+	std::atomic<bool> failed;
+	std::atomic<float> progress;
+	string status;
+	shared_ptr<ofxMapamokCalibrator::Model> finishedModel;
+	ThreadPool pool;
+	std::thread thread;
+};
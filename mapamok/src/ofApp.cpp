@@ -31,13 +31,22 @@ void ofApp::setup() {
 }
 
 void ofApp::update() {
+	// the previous model stays in use until the loader has the new one ready.
+	// it is moved in without copying, and its vbo is uploaded at the next draw
+	shared_ptr<ofxMapamokCalibrator::Model> model = modelLoader.update();
+	if (model) {
+		calibrator.setup(std::move(*model));
+	}
+
 	calibrator.enabled = getb("setupMode");
 
 	if (getb("selectionMode") != calibrator.selectPoints) {
 		calibrator.setState(getb("selectionMode"));
 	}
 
-	if (getb("loadCalibration")) {
+	// point data refers to vertices of the model, so it waits for a pending model, which
+	// would also clear the points when it arrives
+	if (getb("loadCalibration") && !modelLoader.isLoading()) {
 		loadCalibration();
 		setb("loadCalibration", false);
 	}
@@ -55,6 +64,7 @@ void ofApp::update() {
 #define getFlag(flag) (panel.getValueB((#flag)) ? flag : 0)
 		int flags =
 			CV_CALIB_USE_INTRINSIC_GUESS |
+			getFlag(CV_CALIB_FIX_FOCAL_LENGTH) |
 			getFlag(CV_CALIB_FIX_PRINCIPAL_POINT) |
 			getFlag(CV_CALIB_FIX_ASPECT_RATIO) |
 			getFlag(CV_CALIB_FIX_K1) |
@@ -62,6 +72,9 @@ void ofApp::update() {
 			getFlag(CV_CALIB_FIX_K3) |
 			getFlag(CV_CALIB_ZERO_TANGENT_DIST);
 
+		calibrator.mapamok.incrementalCalibration = getb("incrementalCalibration");
+		calibrator.mapamok.robustCalibration = getb("robustCalibration");
+		calibrator.mapamok.autoDistortionModel = getb("autoDistortionModel");
 		calibrator.calibrate(flags);
 	}
 
@@ -72,6 +85,8 @@ void ofApp::update() {
 	}
 	light.setPosition(getf("lightX"), getf("lightY"), getf("lightZ"));
 
+	calibrator.mapamok.distortionMesh = getb("distortionMesh");
+
 	calibrator.setViewport(makeViewport());
 	calibrator.update();
 }
@@ -82,7 +97,7 @@ void ofApp::draw() {
 	int viewports = geti("viewports");
 
 	int i = 0;
-	if (objectMesh.getNumIndices() > 0) {
+	if (calibrator.getMesh().getNumIndices() > 0) {
 		if (getb("setupMode")) {
 			if (viewports > 1) {
 				ofNoFill();
@@ -104,11 +119,18 @@ void ofApp::draw() {
 				message += "Calibration not complete.";
 			}
 		}
-	} else {
+	} else if (!modelLoader.isLoading()) {
 		if (message != "") message += "\n";
 		message += "No model loaded.";
 	}
 
+	if (modelLoader.isLoading()) {
+		string progress = "Loading model: " + ofToString((int) (modelLoader.getProgress() * 100)) + "% (" + modelLoader.getStatus() + ")";
+		ofDrawBitmapStringHighlight(progress, 10, ofGetHeight() - 10);
+	} else if (modelLoader.hasFailed()) {
+		ofDrawBitmapStringHighlight("Could not load the model, see the log.", 10, ofGetHeight() - 10);
+	}
+
 	if (!shader.isLoaded()) {
 		if (message != "") message += "\n";
 		message += "Shader failed to load.";
@@ -145,21 +167,9 @@ void ofApp::dragEvent(ofDragInfo dragInfo) {
 	}
 }
 
+// returns immediately, update() swaps the model in once it is loaded
 void ofApp::loadModel(string fileName) {
-	objectMesh = ofVboMesh();
-	ofFile meshFile(fileName);
-	if (meshFile.exists()) {
-		ofxAssimpModelLoader model;
-		model.loadModel(fileName);
-
-		// join all the meshes
-		objectMesh = ofVboMesh();
-		for (int i = 0; i < model.getNumMeshes(); i++) {
-			objectMesh.append(model.getMesh(i));
-		}
-	}
-	
-	calibrator.setup(objectMesh);
+	modelLoader.load(fileName);
 }
 
 void ofApp::render() {
@@ -191,6 +201,7 @@ void ofApp::render() {
 	}
 
 	ofColor transparentBlack(0, 0, 0, 0);
+	ofVboMesh& objectMesh = calibrator.getMesh();
 	switch(geti("drawMode")) {
 		case 0: // faces
 			if(useShader) shader.begin();
@@ -225,6 +236,7 @@ void ofApp::saveCalibration() {
 
 	calibrator.mapamok.save(dirName + "calibration.yml", dirName + "summary.txt");
 	calibrator.save(dirName + "pointdata.yml");
+	calibrator.saveBinary(dirName + "calibration.bin");
 }
 
 void ofApp::loadCalibration() {
@@ -246,6 +258,12 @@ void ofApp::loadCalibration() {
 	}
 	calibPath = result.getPath();
 
+	// the binary file loads much faster, but the yml files stay the editable originals,
+	// so it is only used while it is newer than both of them
+	if (ofxMapamokCalibrator::isBinaryCurrent(calibPath) && calibrator.loadBinary(calibPath + "/calibration.bin")) {
+		return;
+	}
+
 	ofFile pointDataFile(calibPath + "/pointdata.yml");
 	ofFile calibrationFile(calibPath + "/calibration.yml");
 	if (!pointDataFile.exists() || !calibrationFile.exists()) {
@@ -253,8 +271,12 @@ void ofApp::loadCalibration() {
 		return;
 	}
 
-	calibrator.mapamok.load(calibPath + "/calibration.yml");
-	calibrator.load(calibPath + "/pointdata.yml");
+	if (!calibrator.load(calibPath + "/pointdata.yml") || !calibrator.mapamok.load(calibPath + "/calibration.yml")) {
+		return;
+	}
+	if (ofxMapamokCalibrator::convertToBinary(calibPath)) {
+		ofLogNotice() << "wrote calibration.bin for faster loading";
+	}
 }
 
 void ofApp::resetCalibration() {
@@ -286,6 +308,7 @@ void ofApp::setupControlPanel() {
 	panel.addSlider("lightY", 400, -1000, 1000);
 	panel.addSlider("lightZ", 800, -1000, 1000);
 	panel.addToggle("randomLighting", false);
+	panel.addToggle("distortionMesh", false);
 
 	panel.addPanel("Calibration");
 	panel.addToggle("CV_CALIB_FIX_ASPECT_RATIO", true);
@@ -294,6 +317,10 @@ void ofApp::setupControlPanel() {
 	panel.addToggle("CV_CALIB_FIX_K3", true);
 	panel.addToggle("CV_CALIB_ZERO_TANGENT_DIST", true);
 	panel.addToggle("CV_CALIB_FIX_PRINCIPAL_POINT", false);
+	panel.addToggle("CV_CALIB_FIX_FOCAL_LENGTH", false);
+	panel.addToggle("incrementalCalibration", true);
+	panel.addToggle("robustCalibration", false);
+	panel.addToggle("autoDistortionModel", false);
 }
 
 ofRectangle ofApp::makeViewport()
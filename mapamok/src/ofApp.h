@@ -1,11 +1,11 @@
 #pragma once
 
 #include "ofMain.h"
-#include "ofxAssimpModelLoader.h"
 #include "ofxAutoControlPanel.h"
 #include "ofxMapamokCalibrator.h"
 #include "LineArt.h"
 #include "AutoShader.h"
+#include "ModelLoader.h"
 
 class ofApp : public ofBaseApp {
 public:
@@ -25,7 +25,7 @@ public:
 	void resetCalibration();
 
 	ofxAutoControlPanel panel;
-	ofVboMesh objectMesh;
+	ModelLoader modelLoader;
 
 	ofLight light;
 	AutoShader shader;
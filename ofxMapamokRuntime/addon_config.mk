@@ -0,0 +1,11 @@
+meta:
+	ADDON_NAME = ofxMapamokRuntime
+	ADDON_DESCRIPTION = Playback of ofxMapamok calibrations without OpenCV
+	ADDON_AUTHOR = Aldo Hoeben, Kyle McDonald
+	ADDON_TAGS = "3D" "calibration" "mapamok" "ProCam"
+	ADDON_URL = http://github.com/fieldofview/ofxMapamok
+
+common:
+	# ofxMapamokRuntime, CalibrationFile, LensDistortion, DistortionRemap, FileWatcher
+	# and ThreadPool only use openFrameworks itself
+	ADDON_DEPENDENCIES =
@@ -0,0 +1,281 @@
+#include "CalibrationFile.h"
+#include "ofMain.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char calibrationFileMagic[8] = { 'M', 'A', 'P', 'A', 'M', 'O', 'K', 0 };
+static const size_t checksumStart = offsetof(CalibrationFile::Header, checksum) + sizeof(uint32_t);
+
+// the layout is the file format, it must not depend on the compiler
+static_assert(sizeof(CalibrationFile::Calibration) == 168, "unexpected calibration layout");
+static_assert(sizeof(CalibrationFile::Header) == 232, "unexpected header layout");
+
+static uint64_t align8(uint64_t offset) {
+	return (offset + 7) & ~(uint64_t) 7;
+}
+
+CalibrationFile::CalibrationFile()
+:data(NULL)
+,size(0)
+,header(NULL)
+#ifdef _WIN32
+,fileHandle(NULL)
+,mappingHandle(NULL)
+#endif
+{
+}
+
+CalibrationFile::~CalibrationFile() {
+	close();
+}
+
+bool CalibrationFile::open(const std::string& path) {
+	close();
+	if (!map(ofToDataPath(path, true))) {
+		ofLogError("CalibrationFile") << "could not map " << path;
+		return false;
+	}
+
+	const char* error = NULL;
+	const Header* candidate = (const Header*) data;
+	if (size < sizeof(Header) || memcmp(candidate->magic, calibrationFileMagic, sizeof(calibrationFileMagic)) != 0) {
+		error = "not a calibration file";
+	}
+	else if (candidate->version != version || candidate->headerSize != sizeof(Header)) {
+		error = "unsupported version";
+	}
+	else if (candidate->fileSize != size) {
+		error = "truncated";
+	}
+	else if (crc32(data + checksumStart, size - checksumStart) != candidate->checksum) {
+		error = "checksum mismatch";
+	}
+	else {
+		uint64_t n = candidate->pointCount;
+		if (candidate->objectPointsOffset + n * 3 * sizeof(float) > size ||
+			candidate->imagePointsOffset + n * 2 * sizeof(float) > size ||
+			candidate->pointIndicesOffset + n * sizeof(uint32_t) > size ||
+			(candidate->objectPointsOffset | candidate->imagePointsOffset | candidate->pointIndicesOffset) % 8 != 0) {
+			error = "point data out of bounds";
+		}
+	}
+	if (error) {
+		ofLogError("CalibrationFile") << path << ": " << error;
+		unmap();
+		return false;
+	}
+
+	header = candidate;
+	return true;
+}
+
+void CalibrationFile::close() {
+	header = NULL;
+	unmap();
+}
+
+bool CalibrationFile::isOpen() const {
+	return header != NULL;
+}
+
+const CalibrationFile::Calibration& CalibrationFile::getCalibration() const {
+	return header->calibration;
+}
+
+uint32_t CalibrationFile::getPointCount() const {
+	return header ? header->pointCount : 0;
+}
+
+const float* CalibrationFile::getObjectPoints() const {
+	return (const float*) (data + header->objectPointsOffset);
+}
+
+const float* CalibrationFile::getImagePoints() const {
+	return (const float*) (data + header->imagePointsOffset);
+}
+
+const uint32_t* CalibrationFile::getPointIndices() const {
+	return (const uint32_t*) (data + header->pointIndicesOffset);
+}
+
+bool CalibrationFile::save(const std::string& path, const Calibration& calibration,
+	const std::vector<float>& objectPoints, const std::vector<float>& imagePoints, const std::vector<uint32_t>& pointIndices) {
+	uint32_t n = pointIndices.size();
+	if (objectPoints.size() != n * 3 || imagePoints.size() != n * 2) {
+		ofLogError("CalibrationFile") << "object points, image points and point indices do not match";
+		return false;
+	}
+
+	Header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, calibrationFileMagic, sizeof(calibrationFileMagic));
+	header.version = version;
+	header.headerSize = sizeof(Header);
+	header.calibration = calibration;
+	header.pointCount = n;
+	header.objectPointsOffset = align8(sizeof(Header));
+	header.imagePointsOffset = align8(header.objectPointsOffset + n * 3 * sizeof(float));
+	header.pointIndicesOffset = align8(header.imagePointsOffset + n * 2 * sizeof(float));
+	header.fileSize = align8(header.pointIndicesOffset + n * sizeof(uint32_t));
+
+	std::vector<unsigned char> buffer(header.fileSize, 0);
+	if (n > 0) {
+		memcpy(&buffer[header.objectPointsOffset], objectPoints.data(), n * 3 * sizeof(float));
+		memcpy(&buffer[header.imagePointsOffset], imagePoints.data(), n * 2 * sizeof(float));
+		memcpy(&buffer[header.pointIndicesOffset], pointIndices.data(), n * sizeof(uint32_t));
+	}
+	memcpy(&buffer[0], &header, sizeof(Header));
+	header.checksum = crc32(&buffer[checksumStart], buffer.size() - checksumStart);
+	memcpy(&buffer[offsetof(Header, checksum)], &header.checksum, sizeof(header.checksum));
+
+	// write next to the target and rename, so a reader never maps a half written file
+	std::string fullPath = ofToDataPath(path, true);
+	std::string temporaryPath = fullPath + ".tmp";
+	FILE* file = fopen(temporaryPath.c_str(), "wb");
+	if (!file) {
+		ofLogError("CalibrationFile") << "could not open " << path << " for writing";
+		return false;
+	}
+	bool written = fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+	written = fclose(file) == 0 && written;
+#ifdef _WIN32
+	written = written && MoveFileExA(temporaryPath.c_str(), fullPath.c_str(), MOVEFILE_REPLACE_EXISTING);
+#else
+	written = written && rename(temporaryPath.c_str(), fullPath.c_str()) == 0;
+#endif
+	if (!written) {
+		remove(temporaryPath.c_str());
+		ofLogError("CalibrationFile") << "could not write " << path;
+	}
+	return written;
+}
+
+// reflected CRC-32 as used by zlib and png, so files can be checked with common tools.
+// computed 8 bytes at a time with the slicing-by-8 tables, table[k][i] is the crc of
+// byte i followed by k zero bytes. the checksum covers the whole file, so it is
+// most of what open() costs
+static std::vector<uint32_t> makeCrcTable() {
+	std::vector<uint32_t> table(8 * 256);
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t c = i;
+		for (int k = 0; k < 8; k++) {
+			c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+		}
+		table[i] = c;
+	}
+	for (uint32_t i = 0; i < 256; i++) {
+		for (int k = 1; k < 8; k++) {
+			uint32_t previous = table[(k - 1) * 256 + i];
+			table[k * 256 + i] = table[previous & 0xff] ^ (previous >> 8);
+		}
+	}
+	return table;
+}
+
+uint32_t CalibrationFile::crc32(const void* data, size_t size, uint32_t crc) {
+	static const std::vector<uint32_t> tables = makeCrcTable();
+	const uint32_t* table = &tables[0];
+	const unsigned char* bytes = (const unsigned char*) data;
+	crc = ~crc;
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		const unsigned char* b = bytes + i;
+		uint32_t low = crc ^ (b[0] | b[1] << 8 | b[2] << 16 | (uint32_t) b[3] << 24);
+		uint32_t high = b[4] | b[5] << 8 | b[6] << 16 | (uint32_t) b[7] << 24;
+		crc =
+			table[7 * 256 + (low & 0xff)] ^
+			table[6 * 256 + ((low >> 8) & 0xff)] ^
+			table[5 * 256 + ((low >> 16) & 0xff)] ^
+			table[4 * 256 + (low >> 24)] ^
+			table[3 * 256 + (high & 0xff)] ^
+			table[2 * 256 + ((high >> 8) & 0xff)] ^
+			table[1 * 256 + ((high >> 16) & 0xff)] ^
+			table[high >> 24];
+	}
+	for (; i < size; i++) {
+		crc = table[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+#ifdef _WIN32
+bool CalibrationFile::map(const std::string& path) {
+	fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (fileHandle == INVALID_HANDLE_VALUE) {
+		fileHandle = NULL;
+		return false;
+	}
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0) {
+		unmap();
+		return false;
+	}
+	mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mappingHandle == NULL) {
+		unmap();
+		return false;
+	}
+	data = (const unsigned char*) MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+	if (data == NULL) {
+		unmap();
+		return false;
+	}
+	size = fileSize.QuadPart;
+	return true;
+}
+
+void CalibrationFile::unmap() {
+	if (data) {
+		UnmapViewOfFile(data);
+	}
+	if (mappingHandle) {
+		CloseHandle(mappingHandle);
+	}
+	if (fileHandle) {
+		CloseHandle(fileHandle);
+	}
+	data = NULL;
+	size = 0;
+	mappingHandle = NULL;
+	fileHandle = NULL;
+}
+#else
+bool CalibrationFile::map(const std::string& path) {
+	int descriptor = ::open(path.c_str(), O_RDONLY);
+	if (descriptor < 0) {
+		return false;
+	}
+	struct stat status;
+	if (fstat(descriptor, &status) != 0 || status.st_size == 0) {
+		::close(descriptor);
+		return false;
+	}
+	void* mapping = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+	// the mapping stays valid after the descriptor is closed
+	::close(descriptor);
+	if (mapping == MAP_FAILED) {
+		return false;
+	}
+	data = (const unsigned char*) mapping;
+	size = status.st_size;
+	return true;
+}
+
+void CalibrationFile::unmap() {
+	if (data) {
+		munmap((void*) data, size);
+	}
+	data = NULL;
+	size = 0;
+}
+#endif
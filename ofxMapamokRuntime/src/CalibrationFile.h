@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*
+ CalibrationFile is a binary container for a calibration and its point data,
+ meant to replace calibration.yml and pointdata.yml where startup time matters.
+ It does not depend on OpenCV, and open() memory maps the file, so reading it
+ only validates the header and the checksum and hands out pointers into the
+ mapping.
+
+ Layout, little endian, every array 8 byte aligned:
+ - Header, with the magic, version, size and a CRC-32 of every byte after the
+   checksum field, followed by the calibration values
+ - pointCount * 3 floats of object points
+ - pointCount * 2 floats of image points
+ - pointCount uint32 reference vertex indices
+
+ The version must match exactly, files written with any other version are
+ rejected. It is bumped whenever the layout changes, and calibration.bin can be
+ written again from the yml files with ofxMapamokCalibrator::convertToBinary().
+*/
+
+class CalibrationFile {
+public:
+	static const uint32_t version = 1;
+
+	struct Calibration {
+		double cameraMatrix[9]; // row major
+		double rotationVector[3];
+		double translationVector[3];
+		double distortionCoefficients[5]; // k1, k2, p1, p2, k3
+		int32_t imageWidth, imageHeight;
+	};
+
+	struct Header {
+		char magic[8];
+		uint32_t version;
+		uint32_t headerSize;
+		uint32_t checksum; // covers every byte after this field
+		uint32_t reserved;
+		uint64_t fileSize;
+
+		Calibration calibration;
+		uint32_t pointCount;
+		uint32_t reserved2;
+		uint64_t objectPointsOffset, imagePointsOffset, pointIndicesOffset;
+	};
+
+	CalibrationFile();
+	~CalibrationFile();
+
+	// maps the file and checks it, returns false and logs why when it can't be used
+	bool open(const std::string& path);
+	void close();
+	bool isOpen() const;
+
+	const Calibration& getCalibration() const;
+	uint32_t getPointCount() const;
+	// pointers into the mapping, valid until close()
+	const float* getObjectPoints() const;
+	const float* getImagePoints() const;
+	const uint32_t* getPointIndices() const;
+
+	static bool save(const std::string& path, const Calibration& calibration,
+		const std::vector<float>& objectPoints, const std::vector<float>& imagePoints, const std::vector<uint32_t>& pointIndices);
+
+	static uint32_t crc32(const void* data, size_t size, uint32_t crc = 0);
+
+private:
+	CalibrationFile(const CalibrationFile&);
+	CalibrationFile& operator=(const CalibrationFile&);
+
+	bool map(const std::string& path);
+	void unmap();
+
+	const unsigned char* data;
+	size_t size;
+	const Header* header;
+#ifdef _WIN32
+	void* fileHandle;
+	void* mappingHandle;
+#endif
+};
@@ -0,0 +1,157 @@
+#include "DistortionRemap.h"
+#include "ThreadPool.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define DISTORTIONREMAP_USE_AVX2
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DISTORTIONREMAP_USE_SSE2
+#endif
+
+#include <string.h>
+
+DistortionRemap::DistortionRemap()
+:width(0)
+,height(0) {
+}
+
+void DistortionRemap::setup(const LensDistortion& distortion, int width, int height) {
+	if (width < 2 || height < 2) {
+		ofLogError("DistortionRemap") << "can't remap images smaller than 2x2, got " << width << "x" << height;
+		this->width = 0;
+		this->height = 0;
+		samples.clear();
+		return;
+	}
+	this->width = width;
+	this->height = height;
+	samples.resize((size_t) width * height);
+
+	parallelFor(0, height, [&](size_t begin, size_t end) {
+		for (size_t y = begin; y < end; y++) {
+			Sample* row = &samples[y * width];
+			for (int x = 0; x < width; x++) {
+				// the shader looks up at pixel centers, and linear filtering puts texel centers at +.5
+				ofVec2f texCoord = distortion.getTexCoord(ofVec2f(x + .5f, y + .5f));
+				float u = ofClamp(texCoord.x - .5f, 0, width - 1);
+				float v = ofClamp(texCoord.y - .5f, 0, height - 1);
+				int x0 = MIN((int) u, width - 2);
+				int y0 = MIN((int) v, height - 2);
+				row[x].offset = y0 * width + x0;
+				row[x].fx = (uint16_t) roundf((u - x0) * 256);
+				row[x].fy = (uint16_t) roundf((v - y0) * 256);
+			}
+		}
+	}, 16);
+}
+
+bool DistortionRemap::isReady() const {
+	return !samples.empty();
+}
+
+int DistortionRemap::getWidth() const {
+	return width;
+}
+
+int DistortionRemap::getHeight() const {
+	return height;
+}
+
+void DistortionRemap::remap(const unsigned char* src, unsigned char* dst, bool multiThreaded) const {
+	if (!isReady()) {
+		return;
+	}
+	size_t grainSize = multiThreaded ? 16 : height;
+	parallelFor(0, height, [&](size_t begin, size_t end) {
+		remapRows(src, dst, begin, end);
+	}, grainSize);
+}
+
+void DistortionRemap::remap(const ofPixels& src, ofPixels& dst, bool multiThreaded) const {
+	if (!isReady()) {
+		return;
+	}
+	// ofPixels sizes are size_t, width and height are never negative once ready
+	const size_t w = width, h = height;
+	if (src.getWidth() != w || src.getHeight() != h || src.getNumChannels() != 4) {
+		ofLogError("DistortionRemap") << "remap() needs " << width << "x" << height << " RGBA pixels";
+		return;
+	}
+	if (dst.getWidth() != w || dst.getHeight() != h || dst.getNumChannels() != 4) {
+		dst.allocate(width, height, OF_PIXELS_RGBA);
+	}
+	remap(src.getData(), dst.getData(), multiThreaded);
+}
+
+// every output pixel is ((top left * (256 - fy) + bottom left * fy) * (256 - fx) +
+// (top right * (256 - fy) + bottom right * fy) * fx) / 256 / 256, rounded after each
+// step, so all paths give the same bytes
+void DistortionRemap::remapRows(const unsigned char* src, unsigned char* dst, int begin, int end) const {
+	const size_t stride = (size_t) width * 4;
+	for (int y = begin; y < end; y++) {
+		const Sample* row = &samples[(size_t) y * width];
+		unsigned char* out = dst + y * stride;
+		int x = 0;
+#ifdef DISTORTIONREMAP_USE_AVX2
+		{
+			const __m256i full = _mm256_set1_epi16(256), round = _mm256_set1_epi16(128);
+			for (; x + 2 <= width; x += 2) {
+				const Sample& a = row[x];
+				const Sample& b = row[x + 1];
+				const unsigned char* ta = src + (size_t) a.offset * 4;
+				const unsigned char* tb = src + (size_t) b.offset * 4;
+				// both texel pairs of a in the low half, of b in the high half
+				__m256i top = _mm256_cvtepu8_epi16(_mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*) ta), _mm_loadl_epi64((const __m128i*) tb)));
+				__m256i bottom = _mm256_cvtepu8_epi16(_mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*) (ta + stride)), _mm_loadl_epi64((const __m128i*) (tb + stride))));
+				__m256i fy = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_set1_epi16(a.fy)), _mm_set1_epi16(b.fy), 1);
+				__m256i fx = _mm256_inserti128_si256(_mm256_castsi128_si256(
+					_mm_unpacklo_epi64(_mm_set1_epi16(256 - a.fx), _mm_set1_epi16(a.fx))),
+					_mm_unpacklo_epi64(_mm_set1_epi16(256 - b.fx), _mm_set1_epi16(b.fx)), 1);
+				__m256i vertical = _mm256_add_epi16(_mm256_mullo_epi16(top, _mm256_sub_epi16(full, fy)), _mm256_mullo_epi16(bottom, fy));
+				vertical = _mm256_srli_epi16(_mm256_add_epi16(vertical, round), 8);
+				__m256i horizontal = _mm256_mullo_epi16(vertical, fx);
+				horizontal = _mm256_add_epi16(horizontal, _mm256_srli_si256(horizontal, 8));
+				horizontal = _mm256_srli_epi16(_mm256_add_epi16(horizontal, round), 8);
+				__m256i packed = _mm256_packus_epi16(horizontal, horizontal);
+				int pa = _mm_cvtsi128_si32(_mm256_castsi256_si128(packed));
+				int pb = _mm_cvtsi128_si32(_mm256_extracti128_si256(packed, 1));
+				memcpy(out + x * 4, &pa, 4);
+				memcpy(out + x * 4 + 4, &pb, 4);
+			}
+		}
+#endif
+#ifdef DISTORTIONREMAP_USE_SSE2
+		{
+			const __m128i zero = _mm_setzero_si128(), full = _mm_set1_epi16(256), round = _mm_set1_epi16(128);
+			for (; x < width; x++) {
+				const Sample& s = row[x];
+				const unsigned char* t = src + (size_t) s.offset * 4;
+				// left texel in the low four lanes, right texel in the high four
+				__m128i top = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) t), zero);
+				__m128i bottom = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (t + stride)), zero);
+				__m128i fy = _mm_set1_epi16(s.fy);
+				__m128i fx = _mm_unpacklo_epi64(_mm_set1_epi16(256 - s.fx), _mm_set1_epi16(s.fx));
+				__m128i vertical = _mm_add_epi16(_mm_mullo_epi16(top, _mm_sub_epi16(full, fy)), _mm_mullo_epi16(bottom, fy));
+				vertical = _mm_srli_epi16(_mm_add_epi16(vertical, round), 8);
+				__m128i horizontal = _mm_mullo_epi16(vertical, fx);
+				horizontal = _mm_add_epi16(horizontal, _mm_srli_si128(horizontal, 8));
+				horizontal = _mm_srli_epi16(_mm_add_epi16(horizontal, round), 8);
+				int pixel = _mm_cvtsi128_si32(_mm_packus_epi16(horizontal, horizontal));
+				memcpy(out + x * 4, &pixel, 4);
+			}
+		}
+#endif
+		for (; x < width; x++) {
+			const Sample& s = row[x];
+			const unsigned char* t = src + (size_t) s.offset * 4;
+			const unsigned char* b = t + stride;
+			for (int c = 0; c < 4; c++) {
+				unsigned int left = (t[c] * (256 - s.fy) + b[c] * s.fy + 128) >> 8;
+				unsigned int right = (t[c + 4] * (256 - s.fy) + b[c + 4] * s.fy + 128) >> 8;
+				out[x * 4 + c] = (left * (256 - s.fx) + right * s.fx + 128) >> 8;
+			}
+		}
+	}
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "ofMain.h"
+#include "LensDistortion.h"
+
+#include <stdint.h>
+
+/*
+ DistortionRemap applies the lens distortion to RGBA images on the cpu, the
+ same lookup distortionFragmentShader does with a linearly filtered texture,
+ so calibrations can be checked and content pre-warped without a GL context.
+
+ setup() computes where every output pixel samples the input once per
+ calibration. remap() then only blends four texels per pixel in 8 bit fixed
+ point, with SSE2 or AVX2 when available, over rows in parallel. Input and
+ output have the size of the calibrated image and are in its pixel
+ coordinates, like the texture lookups of the shader.
+*/
+
+class DistortionRemap {
+public:
+	DistortionRemap();
+
+	void setup(const LensDistortion& distortion, int width, int height);
+	bool isReady() const;
+	int getWidth() const;
+	int getHeight() const;
+
+	// src and dst are width * height RGBA pixels and must not overlap
+	void remap(const unsigned char* src, unsigned char* dst, bool multiThreaded = true) const;
+	// allocates dst when needed, src has to be RGBA with the size of the table
+	void remap(const ofPixels& src, ofPixels& dst, bool multiThreaded = true) const;
+
+private:
+	struct Sample {
+		uint32_t offset; // index of the top left texel
+		uint16_t fx, fy; // weights of the right and bottom texels, out of 256
+	};
+
+	void remapRows(const unsigned char* src, unsigned char* dst, int begin, int end) const;
+
+	int width, height;
+	vector<Sample> samples;
+};
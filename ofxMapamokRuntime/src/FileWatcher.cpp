@@ -0,0 +1,201 @@
+#include "FileWatcher.h"
+#include "ofMain.h"
+
+#include <algorithm>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+FileWatcher::FileWatcher()
+:pollInterval(1)
+,usingInotify(false)
+,stopping(false)
+#ifdef __linux__
+,inotifyDescriptor(-1)
+,wakeDescriptor(-1)
+#endif
+{
+}
+
+FileWatcher::~FileWatcher() {
+	stop();
+}
+
+void FileWatcher::setup(const std::vector<std::string>& paths, std::function<void(const std::string&)> onChange, float pollInterval) {
+	stop();
+	this->onChange = onChange;
+	this->pollInterval = pollInterval;
+	files.clear();
+	for (auto const& path : paths) {
+		WatchedFile file;
+		file.path = ofToDataPath(path, true);
+		file.directory = ofFilePath::getEnclosingDirectory(file.path, false);
+		file.name = ofFilePath::getFileName(file.path);
+		// the current state is the baseline, only later changes are reported
+		updateStatus(file);
+		files.push_back(file);
+	}
+
+	stopping = false;
+	usingInotify = false;
+#ifdef __linux__
+	usingInotify = setupInotify();
+	if (usingInotify) {
+		thread = std::thread(&FileWatcher::watchInotify, this);
+		return;
+	}
+	ofLogWarning("FileWatcher") << "inotify is not available, polling every " << pollInterval << " s";
+#endif
+	thread = std::thread(&FileWatcher::poll, this);
+}
+
+void FileWatcher::stop() {
+	if (!thread.joinable()) {
+		return;
+	}
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	condition.notify_all();
+#ifdef __linux__
+	if (wakeDescriptor >= 0) {
+		uint64_t one = 1;
+		if (write(wakeDescriptor, &one, sizeof(one)) < 0) {
+			ofLogWarning("FileWatcher") << "could not wake the watcher thread";
+		}
+	}
+#endif
+	thread.join();
+#ifdef __linux__
+	closeInotify();
+#endif
+}
+
+bool FileWatcher::isWatching() const {
+	return thread.joinable();
+}
+
+bool FileWatcher::isUsingInotify() const {
+	return usingInotify;
+}
+
+static long long getModificationTime(const struct stat& status) {
+#if defined(__linux__)
+	return (long long) status.st_mtim.tv_sec * 1000000000 + status.st_mtim.tv_nsec;
+#elif defined(__APPLE__)
+	return (long long) status.st_mtimespec.tv_sec * 1000000000 + status.st_mtimespec.tv_nsec;
+#else
+	return (long long) status.st_mtime * 1000000000;
+#endif
+}
+
+long long FileWatcher::getModificationTime(const std::string& path) {
+	struct stat status;
+	if (stat(ofToDataPath(path, true).c_str(), &status) != 0) {
+		return 0;
+	}
+	return ::getModificationTime(status);
+}
+
+// true when the modification time or the size differ from the last call
+bool FileWatcher::updateStatus(WatchedFile& file) {
+	struct stat status;
+	long long modified = 0, size = -1;
+	if (stat(file.path.c_str(), &status) == 0) {
+		modified = ::getModificationTime(status);
+		size = status.st_size;
+	}
+	bool changed = modified != file.modified || size != file.size;
+	file.modified = modified;
+	file.size = size;
+	return changed;
+}
+
+void FileWatcher::poll() {
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!stopping) {
+		condition.wait_for(lock, std::chrono::milliseconds((long long) (pollInterval * 1000)));
+		if (stopping) {
+			break;
+		}
+		lock.unlock();
+		for (auto& file : files) {
+			// a deleted file is not a change worth reloading
+			if (updateStatus(file) && file.size >= 0) {
+				onChange(file.path);
+			}
+		}
+		lock.lock();
+	}
+}
+
+#ifdef __linux__
+bool FileWatcher::setupInotify() {
+	inotifyDescriptor = inotify_init1(IN_CLOEXEC);
+	wakeDescriptor = eventfd(0, EFD_CLOEXEC);
+	if (inotifyDescriptor < 0 || wakeDescriptor < 0) {
+		closeInotify();
+		return false;
+	}
+	for (auto& file : files) {
+		// watch the directory, editors and deployment tools often replace the file instead of writing to it
+		file.watchDescriptor = inotify_add_watch(inotifyDescriptor, file.directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+		if (file.watchDescriptor < 0) {
+			closeInotify();
+			return false;
+		}
+	}
+	return true;
+}
+
+void FileWatcher::closeInotify() {
+	if (inotifyDescriptor >= 0) {
+		close(inotifyDescriptor);
+		inotifyDescriptor = -1;
+	}
+	if (wakeDescriptor >= 0) {
+		close(wakeDescriptor);
+		wakeDescriptor = -1;
+	}
+}
+
+void FileWatcher::watchInotify() {
+	// aligned for struct inotify_event
+	alignas(struct inotify_event) char buffer[4096];
+	struct pollfd descriptors[2] = { { inotifyDescriptor, POLLIN, 0 }, { wakeDescriptor, POLLIN, 0 } };
+	while (true) {
+		if (::poll(descriptors, 2, -1) < 0) {
+			continue;
+		}
+		if (descriptors[1].revents) {
+			break;
+		}
+		ssize_t length = read(inotifyDescriptor, buffer, sizeof(buffer));
+		if (length <= 0) {
+			continue;
+		}
+		std::vector<std::string> changed;
+		for (char* cursor = buffer; cursor < buffer + length; ) {
+			struct inotify_event* event = (struct inotify_event*) cursor;
+			if (event->len > 0) {
+				for (auto& file : files) {
+					if (file.watchDescriptor == event->wd && file.name == event->name && std::find(changed.begin(), changed.end(), file.path) == changed.end()) {
+						updateStatus(file);
+						changed.push_back(file.path);
+					}
+				}
+			}
+			cursor += sizeof(struct inotify_event) + event->len;
+		}
+		for (auto const& path : changed) {
+			onChange(path);
+		}
+	}
+}
+#endif
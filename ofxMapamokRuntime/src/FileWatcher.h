@@ -0,0 +1,66 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ FileWatcher notices when files change, without touching the filesystem on the
+ calling thread. A watcher thread waits for inotify events on the directories
+ of the files on Linux, so files that are replaced by a rename are followed
+ too. Elsewhere, or when inotify is not available, the thread compares the
+ modification time and size of every file at pollInterval seconds.
+
+ The callback runs on the watcher thread with the path that changed, so it
+ should only do thread safe work, like reading the file and handing the result
+ to the render thread. It must not call stop() or setup().
+*/
+
+class FileWatcher {
+public:
+	FileWatcher();
+	~FileWatcher();
+
+	void setup(const std::vector<std::string>& paths, std::function<void(const std::string&)> onChange, float pollInterval = 1);
+	void stop();
+	bool isWatching() const;
+	// false when the watcher is polling
+	bool isUsingInotify() const;
+
+	// in nanoseconds, with whatever resolution the platform has, 0 when the file does not exist
+	static long long getModificationTime(const std::string& path);
+
+private:
+	struct WatchedFile {
+		std::string path, directory, name;
+		long long modified = 0, size = -1;
+		int watchDescriptor = -1;
+	};
+
+	FileWatcher(const FileWatcher&);
+	FileWatcher& operator=(const FileWatcher&);
+
+	void poll();
+	bool updateStatus(WatchedFile& file);
+#ifdef __linux__
+	bool setupInotify();
+	void closeInotify();
+	void watchInotify();
+#endif
+
+	std::vector<WatchedFile> files;
+	std::function<void(const std::string&)> onChange;
+	float pollInterval;
+	bool usingInotify;
+
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool stopping;
+#ifdef __linux__
+	int inotifyDescriptor, wakeDescriptor;
+#endif
+};
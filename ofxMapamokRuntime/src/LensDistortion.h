@@ -0,0 +1,154 @@
+#pragma once
+
+#include "ofMain.h"
+
+/*
+ LensDistortion evaluates OpenCV's lens model with only the terms a calibration
+ actually uses. Most calibrations only free k1, so setup() picks the cheapest
+ model that reproduces the coefficients, and every evaluation is a template on
+ that model so the unused terms are compiled out.
+
+ Each model exists in two forms:
+ - distort() is OpenCV's forward model, the same mapping as cv::projectPoints,
+   and is what the cpu projection uses.
+ - getTexCoord() is the lookup the distortion shader does for each output pixel,
+   which divides by the radial term to approximate the inverse.
+
+ The shader is specialized the same way, by compiling it with the line from
+ getShaderDefine() after its #version.
+*/
+
+class LensDistortion {
+public:
+	enum Model {
+		MODEL_NONE = 0,
+		MODEL_K1 = 1, // k1 only
+		MODEL_RADIAL = 2, // k1, k2, k3
+		MODEL_FULL = 3 // k1, k2, k3, p1, p2
+	};
+
+	LensDistortion()
+	:model(MODEL_NONE) {
+	}
+
+	// radial is k1, k2, k3 and tangential is p1, p2, both in opencv's units,
+	// focal length and principal point are in pixels
+	void setup(ofVec3f radial, ofVec2f tangential, ofVec2f focalLength, ofVec2f principalPoint) {
+		this->radial = radial;
+		this->tangential = tangential;
+		this->focalLength = focalLength;
+		this->principalPoint = principalPoint;
+		model = getModel(radial, tangential);
+	}
+
+	static Model getModel(ofVec3f radial, ofVec2f tangential) {
+		if (tangential.x != 0 || tangential.y != 0) {
+			return MODEL_FULL;
+		}
+		if (radial.y != 0 || radial.z != 0) {
+			return MODEL_RADIAL;
+		}
+		if (radial.x != 0) {
+			return MODEL_K1;
+		}
+		return MODEL_NONE;
+	}
+
+	static string getShaderDefine(Model model) {
+		return "#define DISTORTION_MODEL " + ofToString((int) model) + "\n";
+	}
+
+	Model getModel() const {
+		return model;
+	}
+	ofVec3f getRadial() const {
+		return radial;
+	}
+	ofVec2f getTangential() const {
+		return tangential;
+	}
+	ofVec2f getFocalLength() const {
+		return focalLength;
+	}
+	ofVec2f getPrincipalPoint() const {
+		return principalPoint;
+	}
+
+	// forward model in normalized lens coordinates
+	template <Model M>
+	ofVec2f distortNormalized(const ofVec2f& lens) const {
+		if (M == MODEL_NONE) {
+			return lens;
+		}
+		float r2 = lens.x * lens.x + lens.y * lens.y;
+		float factor = M == MODEL_K1 ?
+			1 + r2 * radial.x :
+			1 + r2 * (radial.x + r2 * (radial.y + r2 * radial.z));
+		ofVec2f distorted(lens.x * factor, lens.y * factor);
+		if (M == MODEL_FULL) {
+			float xy2 = 2 * lens.x * lens.y;
+			distorted.x += tangential.x * xy2 + tangential.y * (r2 + 2 * lens.x * lens.x);
+			distorted.y += tangential.y * xy2 + tangential.x * (r2 + 2 * lens.y * lens.y);
+		}
+		return distorted;
+	}
+
+	// shader lookup in normalized lens coordinates
+	template <Model M>
+	ofVec2f getTexCoordNormalized(const ofVec2f& lens) const {
+		if (M == MODEL_NONE) {
+			return lens;
+		}
+		float r2 = lens.x * lens.x + lens.y * lens.y;
+		float factor = M == MODEL_K1 ?
+			1 + r2 * radial.x :
+			1 + r2 * (radial.x + r2 * (radial.y + r2 * radial.z));
+		ofVec2f distorted(lens.x / factor, lens.y / factor);
+		if (M == MODEL_FULL) {
+			float xy2 = 2 * lens.x * lens.y;
+			distorted.x += tangential.x * xy2 + tangential.y * (r2 + 2 * lens.x * lens.x);
+			distorted.y += tangential.y * xy2 + tangential.x * (r2 + 2 * lens.y * lens.y);
+		}
+		return distorted;
+	}
+
+	template <Model M>
+	ofVec2f distort(const ofVec2f& pixel) const {
+		return toPixel(distortNormalized<M>(toLens(pixel)));
+	}
+	template <Model M>
+	ofVec2f getTexCoord(const ofVec2f& pixel) const {
+		return toPixel(getTexCoordNormalized<M>(toLens(pixel)));
+	}
+
+	// the same, dispatched on the model picked by setup(). for many points, switch
+	// on getModel() once and call the template directly
+	ofVec2f distort(const ofVec2f& pixel) const {
+		switch (model) {
+			case MODEL_K1: return distort<MODEL_K1>(pixel);
+			case MODEL_RADIAL: return distort<MODEL_RADIAL>(pixel);
+			case MODEL_FULL: return distort<MODEL_FULL>(pixel);
+			default: return pixel;
+		}
+	}
+	ofVec2f getTexCoord(const ofVec2f& pixel) const {
+		switch (model) {
+			case MODEL_K1: return getTexCoord<MODEL_K1>(pixel);
+			case MODEL_RADIAL: return getTexCoord<MODEL_RADIAL>(pixel);
+			case MODEL_FULL: return getTexCoord<MODEL_FULL>(pixel);
+			default: return pixel;
+		}
+	}
+
+private:
+	ofVec2f toLens(const ofVec2f& pixel) const {
+		return ofVec2f((pixel.x - principalPoint.x) / focalLength.x, (pixel.y - principalPoint.y) / focalLength.y);
+	}
+	ofVec2f toPixel(const ofVec2f& lens) const {
+		return ofVec2f(lens.x * focalLength.x + principalPoint.x, lens.y * focalLength.y + principalPoint.y);
+	}
+
+	Model model;
+	ofVec3f radial;
+	ofVec2f tangential, focalLength, principalPoint;
+};
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ ThreadPool keeps one worker per core alive for the lifetime of the app, so
+ per-frame work can be split across cores without paying for thread creation.
+
+ parallelFor() splits [begin, end) into contiguous chunks and calls
+ function(chunkBegin, chunkEnd) for each of them. The calling thread takes part
+ in the work and only returns once every chunk is done. Nested calls are safe:
+ a waiting thread keeps running the queued chunks of its own call instead of
+ blocking, and never picks up chunks of other calls, so a frame can't end up
+ running somebody else's long task.
+
+ The free parallelFor() uses the pool set for the calling thread with
+ setCurrent(), or the shared one. Background threads like the solver set their
+ own pool, so their long chunks never queue up in front of the render thread's.
+*/
+
+class ThreadPool {
+public:
+	static ThreadPool& getShared() {
+		static ThreadPool pool;
+		return pool;
+	}
+	static ThreadPool& getCurrent() {
+		ThreadPool* pool = current();
+		return pool ? *pool : getShared();
+	}
+	// the pool parallelFor() uses on the calling thread, NULL for the shared one
+	static void setCurrent(ThreadPool* pool) {
+		current() = pool;
+	}
+
+	ThreadPool(unsigned int numThreads = std::thread::hardware_concurrency())
+	:stopping(false) {
+		for (unsigned int i = 1; i < numThreads; i++) {
+			workers.push_back(std::thread(&ThreadPool::work, this));
+		}
+	}
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		condition.notify_all();
+		for (auto& worker : workers) {
+			worker.join();
+		}
+	}
+
+	unsigned int getNumThreads() const {
+		return workers.size() + 1;
+	}
+
+	template <class Function>
+	void parallelFor(size_t begin, size_t end, Function function, size_t grainSize = 1024) {
+		if (end <= begin) {
+			return;
+		}
+		size_t n = end - begin;
+		size_t chunks = std::min<size_t>(getNumThreads() * 4, (n + grainSize - 1) / std::max<size_t>(grainSize, 1));
+		if (chunks <= 1) {
+			function(begin, end);
+			return;
+		}
+		size_t chunkSize = (n + chunks - 1) / chunks;
+		chunks = (n + chunkSize - 1) / chunkSize;
+
+		// the caller returns and destroys all of this as soon as it sees remaining
+		// reach 0, so remaining is only changed and read while holding doneMutex
+		size_t remaining = chunks;
+		std::mutex doneMutex;
+		std::condition_variable done;
+		auto runChunk = [&](size_t chunkBegin, size_t chunkEnd) {
+			function(chunkBegin, chunkEnd);
+			std::lock_guard<std::mutex> lock(doneMutex);
+			if (--remaining == 0) {
+				done.notify_all();
+			}
+		};
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (size_t chunk = 1; chunk < chunks; chunk++) {
+				size_t chunkBegin = begin + chunk * chunkSize;
+				size_t chunkEnd = std::min(end, chunkBegin + chunkSize);
+				tasks.push_back(Task{ &done, [=, &runChunk]() { runChunk(chunkBegin, chunkEnd); } });
+			}
+		}
+		condition.notify_all();
+
+		runChunk(begin, std::min(end, begin + chunkSize));
+		while (runPendingTask(&done)) {
+		}
+		// every other chunk is running on some thread now, and will finish
+		std::unique_lock<std::mutex> lock(doneMutex);
+		done.wait(lock, [&]() { return remaining == 0; });
+	}
+
+private:
+	struct Task {
+		const void* owner; // identifies the parallelFor() call
+		std::function<void()> run;
+	};
+
+	static ThreadPool*& current() {
+		thread_local ThreadPool* pool = NULL;
+		return pool;
+	}
+
+	// runs one queued chunk of the given call
+	bool runPendingTask(const void* owner) {
+		std::function<void()> task;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto found = std::find_if(tasks.begin(), tasks.end(), [owner](const Task& task) { return task.owner == owner; });
+			if (found == tasks.end()) {
+				return false;
+			}
+			task = std::move(found->run);
+			tasks.erase(found);
+		}
+		task();
+		return true;
+	}
+	void work() {
+		// nested calls from chunks stay on this pool
+		setCurrent(this);
+		while (true) {
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				condition.wait(lock, [this]() { return stopping || !tasks.empty(); });
+				if (stopping && tasks.empty()) {
+					return;
+				}
+				task = std::move(tasks.front().run);
+				tasks.pop_front();
+			}
+			task();
+		}
+	}
+
+	std::vector<std::thread> workers;
+	std::deque<Task> tasks;
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool stopping;
+};
+
+template <class Function>
+void parallelFor(size_t begin, size_t end, Function function, size_t grainSize = 1024) {
+	ThreadPool::getCurrent().parallelFor(begin, end, function, grainSize);
+}
@@ -0,0 +1,531 @@
+#include "ofxMapamokRuntime.h"
+#include "ThreadPool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+ofxMapamokRuntime::ofxMapamokRuntime() {
+	memset(&calibration, 0, sizeof(calibration));
+}
+
+ofxMapamokRuntime::~ofxMapamokRuntime() {
+	// the watcher thread calls back into this object
+	stopWatching();
+}
+
+bool ofxMapamokRuntime::load(string fileName) {
+	CalibrationFile::Calibration loaded;
+	if (!readCalibration(fileName, loaded)) {
+		return false;
+	}
+	setData(loaded);
+	return true;
+}
+
+// only touches the file and its arguments, so the watcher thread can use it too
+bool ofxMapamokRuntime::readCalibration(const string& fileName, CalibrationFile::Calibration& calibration) {
+	if (ofToLower(ofFilePath::getFileExt(fileName)) == "bin") {
+		CalibrationFile file;
+		if (!file.open(fileName)) {
+			return false;
+		}
+		calibration = file.getCalibration();
+	}
+	else {
+		ofBuffer buffer = ofBufferFromFile(fileName);
+		if (buffer.size() == 0) {
+			ofLogError() << "could not read " << fileName;
+			return false;
+		}
+		if (!parseYaml(buffer.getText(), calibration)) {
+			ofLogError() << "could not parse " << fileName;
+			return false;
+		}
+	}
+
+	if (calibration.imageWidth == 0 || calibration.imageHeight == 0) {
+		ofLogError() << "calibration does not contain image size";
+		return false;
+	}
+	return true;
+}
+
+void ofxMapamokRuntime::startWatching(string fileName) {
+	calibrationWatcher.setup({ fileName }, [this](const string& path) {
+		CalibrationFile::Calibration calibration;
+		// a file that is still being written fails to parse, the next change brings the rest
+		if (readCalibration(path, calibration)) {
+			std::unique_lock<std::mutex> lock(reloadMutex);
+			reloadedCalibration = calibration;
+			hasReloadedCalibration = true;
+		}
+	});
+}
+
+void ofxMapamokRuntime::stopWatching() {
+	calibrationWatcher.stop();
+	std::unique_lock<std::mutex> lock(reloadMutex);
+	hasReloadedCalibration = false;
+}
+
+void ofxMapamokRuntime::update() {
+	CalibrationFile::Calibration calibration;
+	{
+		std::unique_lock<std::mutex> lock(reloadMutex);
+		if (!hasReloadedCalibration) {
+			return;
+		}
+		calibration = reloadedCalibration;
+		hasReloadedCalibration = false;
+	}
+	ofLogNotice() << "reloaded calibration";
+	setData(calibration);
+}
+
+// reads the numbers of one top level key of an opencv yml file, either a scalar,
+// a [ sequence ] or the data of an !!opencv-matrix, which may span several lines
+static vector<double> getYamlNumbers(const string& text, const string& key) {
+	vector<double> numbers;
+	size_t start = 0;
+	while (true) {
+		start = text.find(key + ":", start);
+		if (start == string::npos) {
+			return numbers;
+		}
+		if (start == 0 || text[start - 1] == '\n') {
+			break;
+		}
+		start += key.size();
+	}
+	size_t end = start;
+	do {
+		end = text.find('\n', end + 1);
+	} while (end != string::npos && end + 1 < text.size() && text[end + 1] == ' ');
+	string block = text.substr(start + key.size() + 1, end == string::npos ? string::npos : end - start - key.size() - 1);
+
+	size_t data = block.find("data:");
+	if (data != string::npos) {
+		block = block.substr(data + 5);
+	}
+	size_t open = block.find('[');
+	size_t close = block.find(']');
+	if (open != string::npos && close != string::npos && close > open) {
+		block = block.substr(open + 1, close - open - 1);
+	}
+	const char* cursor = block.c_str();
+	while (*cursor) {
+		char* next;
+		double value = strtod(cursor, &next);
+		if (next == cursor) {
+			cursor++;
+		}
+		else {
+			numbers.push_back(value);
+			cursor = next;
+		}
+	}
+	return numbers;
+}
+
+bool ofxMapamokRuntime::parseYaml(const string& text, CalibrationFile::Calibration& calibration) {
+	memset(&calibration, 0, sizeof(calibration));
+	vector<double> cameraMatrix = getYamlNumbers(text, "cameraMatrix");
+	vector<double> imageSize = getYamlNumbers(text, "imageSize");
+	vector<double> rotation = getYamlNumbers(text, "rotationVector");
+	vector<double> translation = getYamlNumbers(text, "translationVector");
+	vector<double> distortion = getYamlNumbers(text, "distCoeffs");
+	if (cameraMatrix.size() != 9 || imageSize.size() != 2 || rotation.size() != 3 || translation.size() != 3) {
+		return false;
+	}
+	std::copy(cameraMatrix.begin(), cameraMatrix.end(), calibration.cameraMatrix);
+	std::copy(rotation.begin(), rotation.end(), calibration.rotationVector);
+	std::copy(translation.begin(), translation.end(), calibration.translationVector);
+	std::copy(distortion.begin(), distortion.begin() + std::min<size_t>(distortion.size(), 5), calibration.distortionCoefficients);
+	calibration.imageWidth = imageSize[0];
+	calibration.imageHeight = imageSize[1];
+	return true;
+}
+
+void ofxMapamokRuntime::setData(const CalibrationFile::Calibration& calibration) {
+	this->calibration = calibration;
+	modelMatrix = makeModelMatrix(calibration.rotationVector, calibration.translationVector);
+	matricesDirty = true;
+	distortionMeshDirty = true;
+
+	const double* k = calibration.distortionCoefficients;
+	const double* camera = calibration.cameraMatrix;
+	lensDistortion.setup(
+		ofVec3f(k[0], k[1], k[4]),
+		ofVec2f(k[2], k[3]),
+		ofVec2f(camera[0], camera[4]),
+		ofVec2f(camera[2], camera[5]));
+	useDistortionShader = lensDistortion.getModel() != LensDistortion::MODEL_NONE;
+	if (useDistortionShader) {
+		setupDistortionShader(lensDistortion.getModel());
+		distortionShader.begin();
+		distortionShader.setUniform3f("k", lensDistortion.getRadial());
+		distortionShader.setUniform2f("p", lensDistortion.getTangential());
+		distortionShader.setUniform2f("focalLength", lensDistortion.getFocalLength());
+		distortionShader.setUniform2f("principalPoint", lensDistortion.getPrincipalPoint());
+		distortionShader.end();
+		if (distortionMesh) {
+			updateDistortionMesh();
+		}
+	}
+
+	calibrationReady = true;
+}
+
+bool ofxMapamokRuntime::getData(CalibrationFile::Calibration& calibration) const {
+	if (!calibrationReady) {
+		return false;
+	}
+	calibration = this->calibration;
+	return true;
+}
+
+// keeps watching, the next change of the file loads it again
+void ofxMapamokRuntime::reset() {
+	{
+		// a reload from before the reset would undo it
+		std::unique_lock<std::mutex> lock(reloadMutex);
+		hasReloadedCalibration = false;
+	}
+	calibrationReady = false;
+	memset(&calibration, 0, sizeof(calibration));
+	modelMatrix = ofMatrix4x4();
+	lensDistortion = LensDistortion();
+	useDistortionShader = false;
+	matricesDirty = true;
+}
+
+// the same as cv::calibrationMatrixValues, which ofxMapamok saves, so it also
+// holds for a principal point off the center
+ofVec2f ofxMapamokRuntime::getFov() const {
+	const double* m = calibration.cameraMatrix;
+	return ofVec2f(
+		ofRadToDeg(atan2(m[2], m[0]) + atan2(calibration.imageWidth - m[2], m[0])),
+		ofRadToDeg(atan2(m[5], m[4]) + atan2(calibration.imageHeight - m[5], m[4])));
+}
+
+ofMatrix4x4 ofxMapamokRuntime::makeModelMatrix(const double rotationVector[3], const double translationVector[3]) {
+	// rodrigues: rotate by the length of the vector around its direction
+	double rm[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+	double theta = sqrt(rotationVector[0] * rotationVector[0] + rotationVector[1] * rotationVector[1] + rotationVector[2] * rotationVector[2]);
+	if (theta > 1e-12) {
+		double x = rotationVector[0] / theta, y = rotationVector[1] / theta, z = rotationVector[2] / theta;
+		double c = cos(theta), s = sin(theta), t = 1 - c;
+		double rotation[9] = {
+			c + t * x * x, t * x * y - s * z, t * x * z + s * y,
+			t * x * y + s * z, c + t * y * y, t * y * z - s * x,
+			t * x * z - s * y, t * y * z + s * x, c + t * z * z };
+		memcpy(rm, rotation, sizeof(rm));
+	}
+	const double* tm = translationVector;
+	return ofMatrix4x4(rm[0], rm[3], rm[6], 0.0f,
+		rm[1], rm[4], rm[7], 0.0f,
+		rm[2], rm[5], rm[8], 0.0f,
+		tm[0], tm[1], tm[2], 1.0f);
+}
+
+ofMatrix4x4 ofxMapamokRuntime::makeFrustumMatrix(const CalibrationFile::Calibration& calibration, float nearDist, float farDist) {
+	float w = calibration.imageWidth;
+	float h = calibration.imageHeight;
+	float fx = calibration.cameraMatrix[0];
+	float fy = calibration.cameraMatrix[4];
+	float cx = calibration.cameraMatrix[2];
+	float cy = calibration.cameraMatrix[5];
+
+	ofMatrix4x4 frustum;
+	frustum.makeFrustumMatrix(
+		nearDist * (-cx) / fx, nearDist * (w - cx) / fx,
+		nearDist * (cy) / fy, nearDist * (cy - h) / fy,
+		nearDist, farDist);
+	return frustum;
+}
+
+ofMatrix4x4 ofxMapamokRuntime::makeLookAtMatrix() {
+	ofMatrix4x4 lookAt;
+	lookAt.makeLookAtViewMatrix(ofVec3f(0, 0, 0), ofVec3f(0, 0, 1), ofVec3f(0, -1, 0));
+	return lookAt;
+}
+
+void ofxMapamokRuntime::setViewport(ofRectangle vp) {
+	if (vp != viewport) {
+		viewport = vp;
+	}
+}
+
+
+void ofxMapamokRuntime::begin() {
+	if (!calibrationReady) {
+		return;
+	}
+	updateMatrices();
+	ofPushMatrix();
+	ofSetMatrixMode(OF_MATRIX_PROJECTION);
+	ofPushMatrix();
+	ofLoadMatrix(projectionMatrix);
+	ofSetMatrixMode(OF_MATRIX_MODELVIEW);
+	ofLoadMatrix(modelViewMatrix);
+
+	if (!useDistortionShader) {
+		ofViewport(viewport);
+	}
+	else {
+		if (distortionBuffer.getWidth() != viewport.width || distortionBuffer.getHeight() != viewport.height) {
+			distortionBuffer.allocate(viewport.width, viewport.height, GL_RGBA);
+		}
+		distortionBuffer.begin(false);
+		ofViewport(ofRectangle(0, 0, viewport.width, viewport.height));
+		ofClear(0, 0);
+	}
+
+}
+
+void ofxMapamokRuntime::end() {
+	if (!calibrationReady) {
+		return;
+	}
+
+	if (useDistortionShader) {
+		distortionBuffer.end();
+	}
+
+	// restore default viewport
+	ofViewport(0, 0, ofGetWidth(), ofGetHeight());
+
+	ofPopMatrix();
+	ofSetMatrixMode(OF_MATRIX_PROJECTION);
+	ofPopMatrix();
+	ofSetMatrixMode(OF_MATRIX_MODELVIEW);
+
+	if (useDistortionShader) {
+		if (distortionMesh) {
+			updateDistortionMesh();
+			ofPushMatrix();
+			ofTranslate(viewport.getLeft(), viewport.getBottom());
+			ofScale(1, -1, 1); // draw FBO upside-down
+			distortionBuffer.getTexture().bind();
+			distortionMeshData.draw();
+			distortionBuffer.getTexture().unbind();
+			ofPopMatrix();
+		}
+		else {
+			distortionShader.begin();
+			distortionBuffer.draw(viewport.getLeft(), viewport.getBottom(), viewport.width, -viewport.height); // draw FBO upside-down
+			distortionShader.end();
+		}
+	}
+}
+
+const LensDistortion& ofxMapamokRuntime::getLensDistortion() const {
+	return lensDistortion;
+}
+
+void ofxMapamokRuntime::setupDistortionShader(LensDistortion::Model model) {
+	if (model == distortionShaderModel) {
+		return;
+	}
+	distortionShader.unload();
+	distortionShader.setupShaderFromSource(GL_VERTEX_SHADER, distortionVertexShader);
+	distortionShader.setupShaderFromSource(GL_FRAGMENT_SHADER, "#version 120\n" + LensDistortion::getShaderDefine(model) + distortionFragmentShader);
+
+	if (ofIsGLProgrammableRenderer()) {
+		distortionShader.bindDefaults();
+	}
+	distortionShader.linkProgram();
+	distortionShaderModel = model;
+}
+
+void ofxMapamokRuntime::updateDistortionMesh() {
+	float resolution = MAX(distortionMeshResolution, 1);
+	if (!distortionMeshDirty && resolution == meshResolution && distortionMeshTolerance == meshTolerance) {
+		return;
+	}
+	distortionMeshDirty = false;
+	meshResolution = resolution;
+	meshTolerance = distortionMeshTolerance;
+
+	// like the shader, this assumes the buffer has the size of the calibrated image
+	float width = calibration.imageWidth;
+	float height = calibration.imageHeight;
+	int columns = ceil(width / resolution);
+	int rows = ceil(height / resolution);
+
+	distortionMeshData.clear();
+	distortionMeshData.setMode(OF_PRIMITIVE_TRIANGLES);
+	unordered_map<uint64_t, ofIndexType> vertices;
+	for (int row = 0; row < rows; row++) {
+		float y0 = row * resolution;
+		float y1 = MIN((row + 1) * resolution, height);
+		for (int column = 0; column < columns; column++) {
+			float x0 = column * resolution;
+			float x1 = MIN((column + 1) * resolution, width);
+			addDistortionCell(x0, y0, x1, y1, 0, vertices);
+		}
+	}
+	ofLogVerbose() << "distortion mesh has " << distortionMeshData.getNumVertices() << " vertices";
+}
+
+void ofxMapamokRuntime::addDistortionCell(float x0, float y0, float x1, float y1, int depth, unordered_map<uint64_t, ofIndexType>& vertices) {
+	const int maxDepth = 4;
+	if (depth < maxDepth) {
+		ofVec2f c00 = lensDistortion.getTexCoord(ofVec2f(x0, y0));
+		ofVec2f c10 = lensDistortion.getTexCoord(ofVec2f(x1, y0));
+		ofVec2f c01 = lensDistortion.getTexCoord(ofVec2f(x0, y1));
+		ofVec2f c11 = lensDistortion.getTexCoord(ofVec2f(x1, y1));
+
+		// compare the center and the edge midpoints against the two triangles the cell is drawn with
+		const float samples[5][2] = { { .5, .5 }, { .5, 0 }, { .5, 1 }, { 0, .5 }, { 1, .5 } };
+		float error = 0;
+		for (int i = 0; i < 5; i++) {
+			float s = samples[i][0], t = samples[i][1];
+			ofVec2f interpolated = s >= t ?
+				c00 + (c10 - c00) * s + (c11 - c10) * t :
+				c00 + (c01 - c00) * t + (c11 - c01) * s;
+			ofVec2f exact = lensDistortion.getTexCoord(ofVec2f(ofLerp(x0, x1, s), ofLerp(y0, y1, t)));
+			error = MAX(error, interpolated.distance(exact));
+		}
+
+		if (error > meshTolerance) {
+			float xm = (x0 + x1) / 2, ym = (y0 + y1) / 2;
+			addDistortionCell(x0, y0, xm, ym, depth + 1, vertices);
+			addDistortionCell(xm, y0, x1, ym, depth + 1, vertices);
+			addDistortionCell(x0, ym, xm, y1, depth + 1, vertices);
+			addDistortionCell(xm, ym, x1, y1, depth + 1, vertices);
+			return;
+		}
+	}
+
+	// neighbouring cells of different depth meet at t-junctions, the seam stays within the tolerance
+	ofIndexType i00 = addDistortionVertex(x0, y0, vertices);
+	ofIndexType i10 = addDistortionVertex(x1, y0, vertices);
+	ofIndexType i01 = addDistortionVertex(x0, y1, vertices);
+	ofIndexType i11 = addDistortionVertex(x1, y1, vertices);
+	distortionMeshData.addTriangle(i00, i10, i11);
+	distortionMeshData.addTriangle(i00, i11, i01);
+}
+
+ofIndexType ofxMapamokRuntime::addDistortionVertex(float x, float y, unordered_map<uint64_t, ofIndexType>& vertices) {
+	// cell corners sit on a 1/16 pixel lattice at the deepest level
+	uint64_t key = ((uint64_t) roundf(x * 16) << 32) | (uint32_t) roundf(y * 16);
+	auto found = vertices.find(key);
+	if (found != vertices.end()) {
+		return found->second;
+	}
+	ofIndexType index = distortionMeshData.getNumVertices();
+	distortionMeshData.addVertex(ofVec3f(x, y));
+	distortionMeshData.addTexCoord(lensDistortion.getTexCoord(ofVec2f(x, y)));
+	vertices[key] = index;
+	return index;
+}
+
+template <LensDistortion::Model M>
+ofVec3f ofxMapamokRuntime::projectPoint(const ofVec3f& world, const ofRectangle& viewport) const {
+	ofVec3f CameraXYZ = world * modelViewProjectionMatrix;
+	ofVec3f ScreenXYZ;
+
+	ScreenXYZ.x = (CameraXYZ.x + 1.0f) / 2.0f * viewport.width;
+	ScreenXYZ.y = (1.0f - CameraXYZ.y) / 2.0f * viewport.height;
+
+	if (M != LensDistortion::MODEL_NONE) {
+		// the shader looks up each output pixel through the inverse of this, opencv's forward model
+		ofVec2f distorted = lensDistortion.distort<M>(ofVec2f(ScreenXYZ.x, ScreenXYZ.y));
+		ScreenXYZ.x = distorted.x;
+		ScreenXYZ.y = distorted.y;
+	}
+
+	ScreenXYZ.x += viewport.x;
+	ScreenXYZ.y += viewport.y;
+	ScreenXYZ.z = CameraXYZ.z;
+
+	return ScreenXYZ;
+}
+
+template <LensDistortion::Model M>
+void ofxMapamokRuntime::projectPoints(const vector<ofVec3f>& world, vector<ofVec3f>& screen, const ofRectangle& viewport) const {
+	parallelFor(0, world.size(), [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			screen[i] = projectPoint<M>(world[i], viewport);
+		}
+	}, 4096);
+}
+
+ofVec3f ofxMapamokRuntime::worldToScreen(ofVec3f WorldXYZ, ofRectangle viewport) {
+	if (!calibrationReady) {
+		return WorldXYZ;
+	}
+
+	if (viewport.isZero()) {
+		viewport = ofGetCurrentViewport();
+	}
+
+	updateMatrices();
+	return projectPoint<LensDistortion::MODEL_NONE>(WorldXYZ, viewport);
+}
+
+void ofxMapamokRuntime::worldToScreen(const vector<ofVec3f>& world, vector<ofVec3f>& screen, ofRectangle viewport, bool applyDistortion) {
+	screen.resize(world.size());
+	if (!calibrationReady) {
+		screen = world;
+		return;
+	}
+
+	if (viewport.isZero()) {
+		viewport = ofGetCurrentViewport();
+	}
+
+	updateMatrices();
+	// pick the distortion model once for the whole batch
+	LensDistortion::Model model = applyDistortion && useDistortionShader ? lensDistortion.getModel() : LensDistortion::MODEL_NONE;
+	switch (model) {
+		case LensDistortion::MODEL_K1: projectPoints<LensDistortion::MODEL_K1>(world, screen, viewport); break;
+		case LensDistortion::MODEL_RADIAL: projectPoints<LensDistortion::MODEL_RADIAL>(world, screen, viewport); break;
+		case LensDistortion::MODEL_FULL: projectPoints<LensDistortion::MODEL_FULL>(world, screen, viewport); break;
+		default: projectPoints<LensDistortion::MODEL_NONE>(world, screen, viewport); break;
+	}
+}
+
+void ofxMapamokRuntime::updateMatrices() {
+	if (matricesDirty || nearDist != matrixNearDist || farDist != matrixFarDist) {
+		viewMatrix = makeLookAtMatrix();
+		projectionMatrix = makeFrustumMatrix(calibration, nearDist, farDist);
+		modelViewMatrix = modelMatrix * viewMatrix;
+		modelViewProjectionMatrix = modelViewMatrix * projectionMatrix;
+		matrixNearDist = nearDist;
+		matrixFarDist = farDist;
+		matricesDirty = false;
+	}
+}
+
+const ofMatrix4x4& ofxMapamokRuntime::getModelMatrix() {
+	return modelMatrix;
+}
+
+const ofMatrix4x4& ofxMapamokRuntime::getViewMatrix() {
+	updateMatrices();
+	return viewMatrix;
+}
+
+const ofMatrix4x4& ofxMapamokRuntime::getProjectionMatrix() {
+	updateMatrices();
+	return projectionMatrix;
+}
+
+const ofMatrix4x4& ofxMapamokRuntime::getModelViewMatrix() {
+	updateMatrices();
+	return modelViewMatrix;
+}
+
+const ofMatrix4x4& ofxMapamokRuntime::getModelViewProjectionMatrix() {
+	updateMatrices();
+	return modelViewProjectionMatrix;
+}
+
+void ofxMapamokRuntime::setUniforms(ofShader& shader) {
+	updateMatrices();
+	shader.setUniformMatrix4f("mapamokModelViewMatrix", modelViewMatrix);
+	shader.setUniformMatrix4f("mapamokProjectionMatrix", projectionMatrix);
+	shader.setUniformMatrix4f("mapamokModelViewProjectionMatrix", modelViewProjectionMatrix);
+}
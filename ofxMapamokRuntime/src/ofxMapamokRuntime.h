@@ -0,0 +1,184 @@
+#pragma once
+
+#include "ofMain.h"
+#include "LensDistortion.h"
+#include "CalibrationFile.h"
+#include "FileWatcher.h"
+
+#include <mutex>
+#include <unordered_map>
+
+#ifndef STRINGIFY
+#define STRINGIFY(x) #x
+#endif
+
+/*
+ ofxMapamokRuntime renders with a saved calibration and projects points with
+ it, without OpenCV. Playback apps that never calibrate can use the
+ ofxMapamokRuntime addon on its own, without ofxMapamok and ofxOpenCv.
+
+ It loads calibration.bin, or the calibration.yml ofxMapamok saves through a
+ small parser that only reads the fields it needs. A watched file is parsed on
+ the watcher thread whenever it changes, and update() swaps the result in
+ whole, so a frame never renders with a partly loaded calibration. The pose, frustum and field
+ of view are computed here from the camera matrix and the rotation vector.
+ ofxMapamok builds on it and adds the solver and the OpenCV based file io.
+*/
+
+class ofxMapamokRuntime {
+public:
+	ofxMapamokRuntime();
+	virtual ~ofxMapamokRuntime();
+
+	// calibration.bin, or calibration.yml as saved by ofxMapamok
+	bool load(string fileName);
+	virtual void setData(const CalibrationFile::Calibration& calibration);
+	// false when there is no calibration to copy
+	bool getData(CalibrationFile::Calibration& calibration) const;
+	void setViewport(ofRectangle vp);
+	// drops the calibration, but keeps watching
+	virtual void reset();
+
+	// reloads fileName in the background whenever it changes, see FileWatcher
+	void startWatching(string fileName);
+	void stopWatching();
+	// applies a reloaded calibration, call from the render thread between frames
+	virtual void update();
+
+	void begin();
+	void end();
+
+	// the matrices begin() loads, computed on the CPU so they also work without a GL context
+	const ofMatrix4x4& getModelMatrix();
+	const ofMatrix4x4& getViewMatrix();
+	const ofMatrix4x4& getProjectionMatrix();
+	const ofMatrix4x4& getModelViewMatrix();
+	const ofMatrix4x4& getModelViewProjectionMatrix();
+	// sets mapamokModelViewMatrix, mapamokProjectionMatrix and mapamokModelViewProjectionMatrix
+	// on a shader that is in use, e.g. to render with the calibration outside of begin()/end()
+	void setUniforms(ofShader& shader);
+	// horizontal and vertical field of view in degrees
+	ofVec2f getFov() const;
+
+	ofVec3f worldToScreen(ofVec3f WorldXYZ, ofRectangle viewport = ofRectangle());
+	// projects many points at once without touching GL, optionally through the lens
+	// distortion. that is OpenCV's forward model, so the result matches cv::projectPoints
+	// with the calibration. the distortion shader only approximates its inverse, so
+	// with strong radial terms the rendered output can be a few pixels off from this
+	void worldToScreen(const vector<ofVec3f>& world, vector<ofVec3f>& screen, ofRectangle viewport = ofRectangle(), bool applyDistortion = false);
+	// the lens model of the calibration, e.g. to set up a DistortionRemap
+	const LensDistortion& getLensDistortion() const;
+
+	// the same matrices as Rodrigues and a pinhole frustum from the camera matrix
+	static ofMatrix4x4 makeModelMatrix(const double rotationVector[3], const double translationVector[3]);
+	static ofMatrix4x4 makeFrustumMatrix(const CalibrationFile::Calibration& calibration, float nearDist, float farDist);
+	static ofMatrix4x4 makeLookAtMatrix();
+
+	bool calibrationReady = false;
+	float nearDist = 10;
+	float farDist = 2000;
+	// render the lens distortion through a grid that is warped once on the cpu, instead of
+	// evaluating the lens model for every pixel. cells start at distortionMeshResolution
+	// pixels and are split where the grid would be off by more than distortionMeshTolerance
+	bool distortionMesh = false;
+	float distortionMeshResolution = 32;
+	float distortionMeshTolerance = .25;
+
+private:
+	static bool readCalibration(const string& fileName, CalibrationFile::Calibration& calibration);
+	static bool parseYaml(const string& text, CalibrationFile::Calibration& calibration);
+	void updateMatrices();
+	// M is the distortion model to apply, MODEL_NONE for none
+	template <LensDistortion::Model M>
+	ofVec3f projectPoint(const ofVec3f& world, const ofRectangle& viewport) const;
+	template <LensDistortion::Model M>
+	void projectPoints(const vector<ofVec3f>& world, vector<ofVec3f>& screen, const ofRectangle& viewport) const;
+	void setupDistortionShader(LensDistortion::Model model);
+	void updateDistortionMesh();
+	void addDistortionCell(float x0, float y0, float x1, float y1, int depth, unordered_map<uint64_t, ofIndexType>& vertices);
+	ofIndexType addDistortionVertex(float x, float y, unordered_map<uint64_t, ofIndexType>& vertices);
+
+	CalibrationFile::Calibration calibration;
+	ofMatrix4x4 modelMatrix;
+
+	// model * look at * frustum, rebuilt when the calibration or the clip planes change
+	ofMatrix4x4 viewMatrix, projectionMatrix, modelViewMatrix, modelViewProjectionMatrix;
+	float matrixNearDist = 0, matrixFarDist = 0;
+	bool matricesDirty = true;
+
+	// the distortion shader uniforms, also used by the cpu projection
+	LensDistortion lensDistortion;
+
+	ofRectangle viewport;
+
+	bool useDistortionShader = false;
+	ofShader distortionShader;
+	// the model the shader was last compiled for
+	LensDistortion::Model distortionShaderModel = LensDistortion::MODEL_NONE;
+	ofFbo distortionBuffer;
+
+	// vertices are in buffer pixels, texture coordinates are the distorted lookups
+	ofVboMesh distortionMeshData;
+	bool distortionMeshDirty = true;
+	float meshResolution = 0, meshTolerance = 0;
+
+	std::mutex reloadMutex;
+	bool hasReloadedCalibration = false;
+	CalibrationFile::Calibration reloadedCalibration;
+	// last, so its thread stops before the members it writes to are destroyed
+	FileWatcher calibrationWatcher;
+
+
+	string distortionVertexShader = STRINGIFY(
+		#version 120\n
+
+		varying vec2 texCoordVarying;
+
+		void main(void)
+		{
+			texCoordVarying = gl_MultiTexCoord0.xy;
+			gl_Position = ftransform();
+		}
+	);
+
+	// compiled after a #version and the DISTORTION_MODEL define of LensDistortion,
+	// the branches on it are constant so the unused terms are dropped
+	string distortionFragmentShader = STRINGIFY(
+		varying vec2 texCoordVarying;
+
+		uniform sampler2DRect tex0;
+
+		uniform vec3 k; // radial coefficients k1, k2, k3
+		uniform vec2 p; // tangential coefficients p1, p2
+
+		uniform vec2 focalLength;
+		uniform vec2 principalPoint;
+
+
+		void main()
+		{
+			vec2 lensCoordinates = (texCoordVarying - principalPoint) / focalLength;
+
+			float r_2 = dot(lensCoordinates, lensCoordinates);
+			float radial = 1.f + k.x * r_2;
+			if (DISTORTION_MODEL >= 2) {
+				float r_4 = r_2 * r_2;
+				float r_6 = r_2 * r_4;
+				radial += k.y * r_4 + k.z * r_6;
+			}
+
+			vec2 distorted = lensCoordinates / radial;
+			if (DISTORTION_MODEL >= 3) {
+				float _2xy = 2.f * lensCoordinates.x * lensCoordinates.y;
+				distorted += vec2(
+					(p.x * _2xy) + p.y * (r_2 + 2.f * lensCoordinates.x * lensCoordinates.x),
+					(p.y * _2xy) + p.x * (r_2 + 2.f * lensCoordinates.y * lensCoordinates.y)
+				);
+			}
+
+			vec2 resultUV = distorted * focalLength + principalPoint;
+
+			gl_FragColor = texture2DRect(tex0, resultUV);
+		}
+	);
+};
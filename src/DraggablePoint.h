@@ -1,46 +1,22 @@
 #pragma once
 
+/*
+ DraggablePoint describes how a point in a SelectablePoints collection looks and
+ behaves. The collection stores per-point state in packed arrays (a position, a
+ drag start position, a byte of flags and a selected and marked bit), and
+ shares a single theme of sizes and colors between all of its points.
+*/
+
 class DraggablePoint {
 public:
-	ofVec2f position, positionStart;
-	bool selected, dragging, marked, autoMark;
-
 	enum Sizes { SIZE_CLICK_RADIUS_SQUARED, SIZE_DOT_RADIUS, SIZE_SELECTED_DOT_RADIUS, SIZE_SELECTED_CIRCLE_RADIUS, SIZE_SELECTED_CIRCLE_THICKNESS };
-	vector<float> sizes = { 64, 4., 1., 10., 2. };
 	enum Colors { COLOR_NORMAL, COLOR_MARKED, COLOR_SELECTED, COLOR_CROSSHAIR };
-	vector<ofColor> colors = { ofColor::red, ofColor::pink, ofColor::yellow, ofColor::purple };
+	enum Flags { FLAG_DRAGGING = 1, FLAG_AUTO_MARK = 2 };
 
-	DraggablePoint()
-	:selected(false)
-	,dragging(false)
-	,marked(false)
-	,autoMark(true) {
-	}
-	void reset(bool keepMark = false) {
-		selected = false;
-		dragging = false;
-		if (!keepMark) {
-			marked = false;
-		}
-	}
-	bool isHit(ofVec2f v) {
-		bool curHit = position.distanceSquared(v) < sizes[SIZE_CLICK_RADIUS_SQUARED];
-		if(curHit && autoMark) {
-			marked = true;
-		}
-		return curHit;
-	}
-	void mark(bool mark = true) {
-		marked = mark;
-	}
-	void setAutoMark(bool flag) {
-		autoMark = flag;
-	}
-	void setTheme(vector<float> _sizes, vector<ofColor> _colors) {
-		sizes = _sizes;
-		colors = _colors;
+	static bool isHit(const ofVec2f& position, const ofVec2f& v, const vector<float>& sizes) {
+		return position.distanceSquared(v) < sizes[SIZE_CLICK_RADIUS_SQUARED];
 	}
-	void draw(ofRectangle viewport = ofRectangle()) {
+	static void draw(const ofVec2f& position, bool selected, bool marked, const vector<float>& sizes, const vector<ofColor>& colors, ofRectangle viewport = ofRectangle()) {
 		if (viewport == ofRectangle()) {
 			viewport = ofGetCurrentViewport();
 		}
@@ -71,4 +47,4 @@ public:
 		ofCircle(position, r);
 		ofPopStyle();
 	}
-};
\ No newline at end of file
+};
@@ -5,10 +5,12 @@
 class DraggablePoints : public SelectablePoints {
 protected:
 	ofVec2f mouseStart;
+	vector<unsigned int> selectedPoints;
 	
 	void cachePositions() {
-		for(set<unsigned int>::iterator itr = selected.begin(); itr != selected.end(); itr++) {
-			points[*itr].positionStart = points[*itr].position;
+		selected.getSetBits(selectedPoints);
+		for(unsigned int i = 0; i < selectedPoints.size(); i++) {
+			positionsStart[selectedPoints[i]] = getPosition(selectedPoints[i]);
 		}
 	}
 	static bool isDirectionKey(int key) {
@@ -36,9 +38,9 @@ public:
 	}
 	void mouseDragged(ofMouseEventArgs& mouse) {
 		ofVec2f offset = mouse - mouseStart;
-		for(set<unsigned int>::iterator itr = selected.begin(); itr != selected.end(); itr++) {
-			points[*itr].position = points[*itr].positionStart + offset;
-			pointsChanged = true;
+		selected.getSetBits(selectedPoints);
+		for(unsigned int i = 0; i < selectedPoints.size(); i++) {
+			setPosition(selectedPoints[i], positionsStart[selectedPoints[i]] + offset);
 		}
 	}
 	void mouseReleased(ofMouseEventArgs& mouse) {
@@ -49,9 +51,9 @@ public:
 		if(isDirectionKey(key.key)) {
 			float multiplier = ofGetKeyPressed(OF_KEY_COMMAND) ? .25 : 1;
 			ofVec2f offset = multiplier * getDirectionFromKey(key.key);
-			for(set<unsigned int>::iterator itr = selected.begin(); itr != selected.end(); itr++) {
-				points[*itr].position += offset;
-				pointsChanged = true;
+			selected.getSetBits(selectedPoints);
+			for(unsigned int i = 0; i < selectedPoints.size(); i++) {
+				setPosition(selectedPoints[i], getPosition(selectedPoints[i]) + offset);
 			}
 		}
 	}
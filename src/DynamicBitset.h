@@ -0,0 +1,110 @@
+#pragma once
+
+#include <algorithm>
+#include <stdint.h>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/*
+ DynamicBitset is a resizable set of bits packed into 64 bit words. It keeps a
+ running count of the set bits, so count() is O(1) and listing the set bits can
+ stop as soon as all of them have been found.
+*/
+
+class DynamicBitset {
+public:
+	DynamicBitset()
+	:bits(0)
+	,setCount(0) {
+	}
+
+	unsigned int size() const {
+		return bits;
+	}
+	unsigned int count() const {
+		return setCount;
+	}
+	bool test(unsigned int i) const {
+		return (words[i >> 6] >> (i & 63)) & 1;
+	}
+	void set(unsigned int i, bool value = true) {
+		uint64_t mask = uint64_t(1) << (i & 63);
+		uint64_t& word = words[i >> 6];
+		if (value && !(word & mask)) {
+			word |= mask;
+			setCount++;
+		} else if (!value && (word & mask)) {
+			word &= ~mask;
+			setCount--;
+		}
+	}
+	void push_back(bool value) {
+		resize(bits + 1);
+		set(bits - 1, value);
+	}
+	// new bits start cleared
+	void resize(unsigned int n) {
+		for (unsigned int i = n; i < bits; i++) {
+			set(i, false);
+		}
+		bits = n;
+		words.resize((n + 63) / 64, 0);
+	}
+	// clears all bits, O(1) when nothing is set
+	void reset() {
+		if (setCount > 0) {
+			std::fill(words.begin(), words.end(), 0);
+			setCount = 0;
+		}
+	}
+	void clear() {
+		words.clear();
+		bits = 0;
+		setCount = 0;
+	}
+	// moves the last bit into position i and shrinks by one
+	void swapRemove(unsigned int i) {
+		unsigned int last = bits - 1;
+		bool lastValue = test(last);
+		set(last, false);
+		if (i != last) {
+			set(i, lastValue);
+		}
+		resize(last);
+	}
+	// overwrites result with the indices of all set bits in ascending order
+	void getSetBits(std::vector<unsigned int>& result) const {
+		result.clear();
+		for (unsigned int w = 0; w < words.size() && result.size() < setCount; w++) {
+			uint64_t word = words[w];
+			while (word) {
+				result.push_back((w << 6) + countTrailingZeros(word));
+				word &= word - 1;
+			}
+		}
+	}
+
+private:
+	static unsigned int countTrailingZeros(uint64_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+		return __builtin_ctzll(word);
+#elif defined(_MSC_VER) && defined(_M_X64)
+		unsigned long index;
+		_BitScanForward64(&index, word);
+		return index;
+#else
+		unsigned int index = 0;
+		while (!(word & 1)) {
+			word >>= 1;
+			index++;
+		}
+		return index;
+#endif
+	}
+
+	std::vector<uint64_t> words;
+	unsigned int bits, setCount;
+};
@@ -65,6 +65,14 @@ void Intrinsics::loadProjectionMatrix(float nearDist, float farDist, cv::Point2d
 	ofViewport(viewportOffset.x, viewportOffset.y, imageSize.width, imageSize.height);
 	ofSetMatrixMode(OF_MATRIX_PROJECTION);
 	ofLoadIdentityMatrix();
+	ofMultMatrix(getFrustumMatrix(nearDist, farDist));
+
+	ofSetMatrixMode(OF_MATRIX_MODELVIEW);
+	ofLoadIdentityMatrix();
+	ofMultMatrix(getLookAtMatrix());
+}
+
+ofMatrix4x4 Intrinsics::getFrustumMatrix(float nearDist, float farDist) const {
 	float w = imageSize.width;
 	float h = imageSize.height;
 	float fx = cameraMatrix.at<double>(0, 0);
@@ -77,12 +85,11 @@ void Intrinsics::loadProjectionMatrix(float nearDist, float farDist, cv::Point2d
 		nearDist * (-cx) / fx, nearDist * (w - cx) / fx,
 		nearDist * (cy) / fy, nearDist * (cy - h) / fy,
 		nearDist, farDist);
-	ofMultMatrix(frustum);
-
-	ofSetMatrixMode(OF_MATRIX_MODELVIEW);
-	ofLoadIdentityMatrix();
+	return frustum;
+}
 
+ofMatrix4x4 Intrinsics::getLookAtMatrix() const {
 	ofMatrix4x4 lookAt;
 	lookAt.makeLookAtViewMatrix(ofVec3f(0, 0, 0), ofVec3f(0, 0, 1), ofVec3f(0, -1, 0));
-	ofMultMatrix(lookAt);
+	return lookAt;
 }
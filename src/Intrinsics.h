@@ -14,6 +14,9 @@ public:
 	double getAspectRatio() const;
 	cv::Point2d getPrincipalPoint() const;
 	void loadProjectionMatrix(float nearDist = 10., float farDist = 10000., cv::Point2d viewportOffset = cv::Point2d(0, 0)) const;
+	// the matrices loadProjectionMatrix() puts on the stack, without touching GL
+	ofMatrix4x4 getFrustumMatrix(float nearDist = 10., float farDist = 10000.) const;
+	ofMatrix4x4 getLookAtMatrix() const;
 protected:
 	void updateValues();
 	cv::Mat cameraMatrix;
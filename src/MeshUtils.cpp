@@ -1,4 +1,35 @@
 #include "MeshUtils.h"
+#include "ThreadPool.h"
+
+#include <unordered_map>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define MESHUTILS_USE_AVX
+#endif
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define MESHUTILS_USE_SSE
+#endif
+
+void PositionBuffer::setup(const vector<ofVec3f>& vertices) {
+	resize(vertices.size());
+	for (unsigned int i = 0; i < vertices.size(); i++) {
+		x[i] = vertices[i].x;
+		y[i] = vertices[i].y;
+		z[i] = vertices[i].z;
+	}
+}
+
+void PositionBuffer::resize(unsigned int n) {
+	x.resize(n);
+	y.resize(n);
+	z.resize(n);
+}
+
+unsigned int PositionBuffer::size() const {
+	return x.size();
+}
 
 int findNearestVertex(const vector<ofVec3f>& vertices, const ofVec3f& base) {
 	int nearestIndex = 0;
@@ -15,38 +46,302 @@ int findNearestVertex(const vector<ofVec3f>& vertices, const ofVec3f& base) {
 }
 
 
+int findNearestVertex(const VertexIndex& index, const ofVec3f& base) {
+	return index.findNearest(base);
+}
+
+
+namespace {
+	const unsigned int leafSize = 8;
+
+	struct IndexedVertex {
+		ofVec3f vertex;
+		unsigned int index;
+	};
+
+	unsigned char largestAxis(const vector<IndexedVertex>& entries, unsigned int begin, unsigned int end) {
+		ofVec3f min = entries[begin].vertex, max = entries[begin].vertex;
+		for (unsigned int i = begin + 1; i < end; i++) {
+			for (int axis = 0; axis < 3; axis++) {
+				min[axis] = std::min(min[axis], entries[i].vertex[axis]);
+				max[axis] = std::max(max[axis], entries[i].vertex[axis]);
+			}
+		}
+		ofVec3f extent = max - min;
+		if (extent.x >= extent.y && extent.x >= extent.z) {
+			return 0;
+		}
+		return extent.y >= extent.z ? 1 : 2;
+	}
+
+	// each range [begin, end) is a node: the median element at mid splits the
+	// remaining elements along splitAxes[mid], small ranges are scanned as leaves
+	void buildTree(vector<IndexedVertex>& entries, vector<unsigned char>& splitAxes, unsigned int begin, unsigned int end, bool multiThreaded) {
+		if (end - begin <= leafSize) {
+			return;
+		}
+		unsigned int mid = (begin + end) / 2;
+		unsigned char axis = largestAxis(entries, begin, end);
+		splitAxes[mid] = axis;
+		nth_element(entries.begin() + begin, entries.begin() + mid, entries.begin() + end, [axis](const IndexedVertex& a, const IndexedVertex& b) {
+			return a.vertex[axis] < b.vertex[axis];
+		});
+
+		// only fork while the halves are big enough to be worth it
+		bool fork = multiThreaded && end - begin > 1 << 16;
+		parallelFor(0, 2, [&](size_t first, size_t last) {
+			for (size_t child = first; child < last; child++) {
+				if (child == 0) {
+					buildTree(entries, splitAxes, begin, mid, multiThreaded);
+				}
+				else {
+					buildTree(entries, splitAxes, mid + 1, end, multiThreaded);
+				}
+			}
+		}, fork ? 1 : 2);
+	}
+}
+
+void VertexIndex::setup(const vector<ofVec3f>& vertices, bool multiThreaded) {
+	unsigned int n = vertices.size();
+	vector<IndexedVertex> entries(n);
+	for (unsigned int i = 0; i < n; i++) {
+		entries[i].vertex = vertices[i];
+		entries[i].index = i;
+	}
+	splitAxes.assign(n, 0);
+	buildTree(entries, splitAxes, 0, n, multiThreaded);
+
+	this->vertices.resize(n);
+	indices.resize(n);
+	for (unsigned int i = 0; i < n; i++) {
+		this->vertices[i] = entries[i].vertex;
+		indices[i] = entries[i].index;
+	}
+}
+
+void VertexIndex::clear() {
+	vertices.clear();
+	indices.clear();
+	splitAxes.clear();
+}
+
+unsigned int VertexIndex::size() const {
+	return vertices.size();
+}
+
+int VertexIndex::findNearest(const ofVec3f& base) const {
+	int nearestIndex = -1;
+	float nearestDistance = 0;
+	searchNearest(0, vertices.size(), base, nearestIndex, nearestDistance);
+	return nearestIndex;
+}
+
+// returns up to k indices, nearest first
+vector<unsigned int> VertexIndex::findNearest(const ofVec3f& base, unsigned int k) const {
+	vector<pair<float, unsigned int> > heap;
+	if (k > 0) {
+		heap.reserve(k + 1);
+		searchNearest(0, vertices.size(), base, k, heap);
+	}
+	sort_heap(heap.begin(), heap.end());
+	vector<unsigned int> result(heap.size());
+	for (unsigned int i = 0; i < heap.size(); i++) {
+		result[i] = heap[i].second;
+	}
+	return result;
+}
+
+// returns all indices within radius, in no particular order
+vector<unsigned int> VertexIndex::findWithinRadius(const ofVec3f& base, float radius) const {
+	vector<unsigned int> result;
+	searchRadius(0, vertices.size(), base, radius * radius, result);
+	return result;
+}
+
+void VertexIndex::searchNearest(unsigned int begin, unsigned int end, const ofVec3f& base, int& nearestIndex, float& nearestDistance) const {
+	if (end - begin <= leafSize) {
+		for (unsigned int i = begin; i < end; i++) {
+			float distance = base.squareDistance(vertices[i]);
+			// ties go to the lowest index, like findNearestVertex on the raw vertices
+			if (nearestIndex == -1 || distance < nearestDistance || (distance == nearestDistance && (int) indices[i] < nearestIndex)) {
+				nearestDistance = distance;
+				nearestIndex = indices[i];
+			}
+		}
+		return;
+	}
+	unsigned int mid = (begin + end) / 2;
+	searchNearest(mid, mid + 1, base, nearestIndex, nearestDistance);
+	float offset = base[splitAxes[mid]] - vertices[mid][splitAxes[mid]];
+	if (offset < 0) {
+		searchNearest(begin, mid, base, nearestIndex, nearestDistance);
+		if (offset * offset <= nearestDistance) {
+			searchNearest(mid + 1, end, base, nearestIndex, nearestDistance);
+		}
+	}
+	else {
+		searchNearest(mid + 1, end, base, nearestIndex, nearestDistance);
+		if (offset * offset <= nearestDistance) {
+			searchNearest(begin, mid, base, nearestIndex, nearestDistance);
+		}
+	}
+}
+
+// heap is a max-heap on distance holding the best k candidates so far
+void VertexIndex::searchNearest(unsigned int begin, unsigned int end, const ofVec3f& base, unsigned int k, vector<pair<float, unsigned int> >& heap) const {
+	if (end - begin <= leafSize) {
+		for (unsigned int i = begin; i < end; i++) {
+			pair<float, unsigned int> candidate(base.squareDistance(vertices[i]), indices[i]);
+			if (heap.size() < k) {
+				heap.push_back(candidate);
+				push_heap(heap.begin(), heap.end());
+			}
+			else if (candidate < heap.front()) {
+				pop_heap(heap.begin(), heap.end());
+				heap.back() = candidate;
+				push_heap(heap.begin(), heap.end());
+			}
+		}
+		return;
+	}
+	unsigned int mid = (begin + end) / 2;
+	searchNearest(mid, mid + 1, base, k, heap);
+	float offset = base[splitAxes[mid]] - vertices[mid][splitAxes[mid]];
+	unsigned int nearBegin = offset < 0 ? begin : mid + 1;
+	unsigned int nearEnd = offset < 0 ? mid : end;
+	unsigned int farBegin = offset < 0 ? mid + 1 : begin;
+	unsigned int farEnd = offset < 0 ? end : mid;
+	searchNearest(nearBegin, nearEnd, base, k, heap);
+	if (heap.size() < k || offset * offset <= heap.front().first) {
+		searchNearest(farBegin, farEnd, base, k, heap);
+	}
+}
+
+void VertexIndex::searchRadius(unsigned int begin, unsigned int end, const ofVec3f& base, float squareRadius, vector<unsigned int>& result) const {
+	if (end - begin <= leafSize) {
+		for (unsigned int i = begin; i < end; i++) {
+			if (base.squareDistance(vertices[i]) <= squareRadius) {
+				result.push_back(indices[i]);
+			}
+		}
+		return;
+	}
+	unsigned int mid = (begin + end) / 2;
+	searchRadius(mid, mid + 1, base, squareRadius, result);
+	float offset = base[splitAxes[mid]] - vertices[mid][splitAxes[mid]];
+	if (offset < 0 || offset * offset <= squareRadius) {
+		searchRadius(begin, mid, base, squareRadius, result);
+	}
+	if (offset >= 0 || offset * offset <= squareRadius) {
+		searchRadius(mid + 1, end, base, squareRadius, result);
+	}
+}
+
+
+namespace {
+	struct GridCell {
+		int64_t x, y, z;
+		bool operator==(const GridCell& other) const {
+			return x == other.x && y == other.y && z == other.z;
+		}
+	};
+	struct GridCellHash {
+		size_t operator()(const GridCell& cell) const {
+			return (size_t) ((uint64_t) cell.x * 73856093u ^ (uint64_t) cell.y * 19349663u ^ (uint64_t) cell.z * 83492791u);
+		}
+	};
+}
+
 // assumes mesh is indexed
 // drops all normals, colors, and tex coords
-ofMesh mergeNearbyVertices(const ofMesh& mesh, float tolerance) {
+// vertices are welded in order to the nearest previously kept vertex closer
+// than tolerance, using a uniform grid with tolerance-sized cells so only
+// the 27 cells around each vertex have to be searched.
+ofMesh mergeNearbyVertices(const ofMesh& mesh, float tolerance, bool multiThreaded) {
 	if (tolerance == 0) {
 		return mesh;
 	}
 	float squareTolerance = tolerance * tolerance;
-	ofMesh mergedMesh;
+	const vector<ofVec3f>& vertices = mesh.getVertices();
 	int n = mesh.getNumVertices();
-	vector<int> remappedIndices;
+
+	// cells are slightly larger than the tolerance so rounding can never put
+	// two vertices closer than the tolerance more than one cell apart
+	double cellScale = 1. / (tolerance * 1.001);
+	vector<GridCell> cells(n);
+	auto findCells = [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			const ofVec3f& cur = vertices[i];
+			cells[i].x = (int64_t) floor(cur.x * cellScale);
+			cells[i].y = (int64_t) floor(cur.y * cellScale);
+			cells[i].z = (int64_t) floor(cur.z * cellScale);
+		}
+	};
+	if (multiThreaded) {
+		parallelFor(0, n, findCells, 4096);
+	} else {
+		findCells(0, n);
+	}
+
+	// each grid cell points to the last kept vertex inside it,
+	// which links to the previous one in the same cell
+	unordered_map<GridCell, int, GridCellHash> cellHeads;
+	cellHeads.reserve(n);
+	vector<int> cellNext;
+	vector<ofVec3f> mergedVertices;
+	vector<int> remappedIndices(n);
 	for (int i = 0; i < n; i++) {
-		const ofVec3f& cur = mesh.getVertices()[i];
-		if (mergedMesh.getNumVertices() > 0) {
-			int nearestIndex = findNearestVertex(mergedMesh.getVertices(), cur);
-			const ofVec3f& nearestVertex = mergedMesh.getVertices()[nearestIndex];
-			if (cur.squareDistance(nearestVertex) < squareTolerance) {
-				remappedIndices.push_back(nearestIndex);
-			}
-			else {
-				remappedIndices.push_back(mergedMesh.getNumVertices());
-				mergedMesh.addVertex(cur);
+		const ofVec3f& cur = vertices[i];
+		const GridCell& cell = cells[i];
+		int nearestIndex = -1;
+		float nearestDistance = 0;
+		for (int dz = -1; dz <= 1; dz++) {
+			for (int dy = -1; dy <= 1; dy++) {
+				for (int dx = -1; dx <= 1; dx++) {
+					auto head = cellHeads.find(GridCell{cell.x + dx, cell.y + dy, cell.z + dz});
+					if (head == cellHeads.end()) {
+						continue;
+					}
+					for (int j = head->second; j != -1; j = cellNext[j]) {
+						float distance = cur.squareDistance(mergedVertices[j]);
+						// ties go to the earliest kept vertex, like a linear scan would
+						if (nearestIndex == -1 || distance < nearestDistance || (distance == nearestDistance && j < nearestIndex)) {
+							nearestDistance = distance;
+							nearestIndex = j;
+						}
+					}
+				}
 			}
 		}
+		if (nearestIndex != -1 && nearestDistance < squareTolerance) {
+			remappedIndices[i] = nearestIndex;
+		}
 		else {
-			remappedIndices.push_back(0);
-			mergedMesh.addVertex(cur);
+			int mergedIndex = mergedVertices.size();
+			remappedIndices[i] = mergedIndex;
+			mergedVertices.push_back(cur);
+			auto head = cellHeads.insert(make_pair(cell, -1)).first;
+			cellNext.push_back(head->second);
+			head->second = mergedIndex;
 		}
 	}
-	n = mesh.getNumIndices();
-	for (int i = 0; i < n; i++) {
-		mergedMesh.addIndex(remappedIndices[mesh.getIndex(i)]);
+
+	ofMesh mergedMesh;
+	mergedMesh.addVertices(mergedVertices);
+	const vector<ofIndexType>& indices = mesh.getIndices();
+	vector<ofIndexType> mergedIndices(indices.size());
+	auto remapIndices = [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			mergedIndices[i] = remappedIndices[indices[i]];
+		}
+	};
+	if (multiThreaded) {
+		parallelFor(0, indices.size(), remapIndices, 4096);
+	} else {
+		remapIndices(0, indices.size());
 	}
+	mergedMesh.addIndices(mergedIndices);
 	return mergedMesh;
 }
 
@@ -63,3 +358,277 @@ void project(ofMesh& mesh, const ofCamera& camera, ofRectangle viewport) {
 		cur.z = CameraXYZ.z / 2;
 	}
 }
+
+
+namespace {
+	// m is a row-major ofMatrix4x4, vertices are treated as row vectors like ofVec3f * ofMatrix4x4
+	void projectRange(const PositionBuffer& positions, const float* m, const ofRectangle& viewport, PositionBuffer& result, size_t begin, size_t end) {
+		const float* x = &positions.x[0];
+		const float* y = &positions.y[0];
+		const float* z = &positions.z[0];
+		float* rx = &result.x[0];
+		float* ry = &result.y[0];
+		float* rz = &result.z[0];
+		float halfWidth = viewport.width / 2, halfHeight = viewport.height / 2;
+		size_t i = begin;
+
+#ifdef MESHUTILS_USE_AVX
+		{
+			__m256 m0 = _mm256_set1_ps(m[0]), m1 = _mm256_set1_ps(m[1]), m2 = _mm256_set1_ps(m[2]), m3 = _mm256_set1_ps(m[3]);
+			__m256 m4 = _mm256_set1_ps(m[4]), m5 = _mm256_set1_ps(m[5]), m6 = _mm256_set1_ps(m[6]), m7 = _mm256_set1_ps(m[7]);
+			__m256 m8 = _mm256_set1_ps(m[8]), m9 = _mm256_set1_ps(m[9]), m10 = _mm256_set1_ps(m[10]), m11 = _mm256_set1_ps(m[11]);
+			__m256 m12 = _mm256_set1_ps(m[12]), m13 = _mm256_set1_ps(m[13]), m14 = _mm256_set1_ps(m[14]), m15 = _mm256_set1_ps(m[15]);
+			__m256 one = _mm256_set1_ps(1), half = _mm256_set1_ps(.5);
+			__m256 scaleX = _mm256_set1_ps(halfWidth), scaleY = _mm256_set1_ps(halfHeight);
+			__m256 offsetX = _mm256_set1_ps(viewport.x), offsetY = _mm256_set1_ps(viewport.y);
+			for (; i + 8 <= end; i += 8) {
+				__m256 vx = _mm256_loadu_ps(x + i), vy = _mm256_loadu_ps(y + i), vz = _mm256_loadu_ps(z + i);
+				__m256 cx = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, m0), _mm256_mul_ps(vy, m4)), _mm256_add_ps(_mm256_mul_ps(vz, m8), m12));
+				__m256 cy = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, m1), _mm256_mul_ps(vy, m5)), _mm256_add_ps(_mm256_mul_ps(vz, m9), m13));
+				__m256 cz = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, m2), _mm256_mul_ps(vy, m6)), _mm256_add_ps(_mm256_mul_ps(vz, m10), m14));
+				__m256 cw = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, m3), _mm256_mul_ps(vy, m7)), _mm256_add_ps(_mm256_mul_ps(vz, m11), m15));
+				__m256 inverseW = _mm256_div_ps(one, cw);
+				_mm256_storeu_ps(rx + i, _mm256_add_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(cx, inverseW), one), scaleX), offsetX));
+				_mm256_storeu_ps(ry + i, _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(one, _mm256_mul_ps(cy, inverseW)), scaleY), offsetY));
+				_mm256_storeu_ps(rz + i, _mm256_mul_ps(_mm256_mul_ps(cz, inverseW), half));
+			}
+		}
+#endif
+#ifdef MESHUTILS_USE_SSE
+		{
+			__m128 m0 = _mm_set1_ps(m[0]), m1 = _mm_set1_ps(m[1]), m2 = _mm_set1_ps(m[2]), m3 = _mm_set1_ps(m[3]);
+			__m128 m4 = _mm_set1_ps(m[4]), m5 = _mm_set1_ps(m[5]), m6 = _mm_set1_ps(m[6]), m7 = _mm_set1_ps(m[7]);
+			__m128 m8 = _mm_set1_ps(m[8]), m9 = _mm_set1_ps(m[9]), m10 = _mm_set1_ps(m[10]), m11 = _mm_set1_ps(m[11]);
+			__m128 m12 = _mm_set1_ps(m[12]), m13 = _mm_set1_ps(m[13]), m14 = _mm_set1_ps(m[14]), m15 = _mm_set1_ps(m[15]);
+			__m128 one = _mm_set1_ps(1), half = _mm_set1_ps(.5);
+			__m128 scaleX = _mm_set1_ps(halfWidth), scaleY = _mm_set1_ps(halfHeight);
+			__m128 offsetX = _mm_set1_ps(viewport.x), offsetY = _mm_set1_ps(viewport.y);
+			for (; i + 4 <= end; i += 4) {
+				__m128 vx = _mm_loadu_ps(x + i), vy = _mm_loadu_ps(y + i), vz = _mm_loadu_ps(z + i);
+				__m128 cx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, m0), _mm_mul_ps(vy, m4)), _mm_add_ps(_mm_mul_ps(vz, m8), m12));
+				__m128 cy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, m1), _mm_mul_ps(vy, m5)), _mm_add_ps(_mm_mul_ps(vz, m9), m13));
+				__m128 cz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, m2), _mm_mul_ps(vy, m6)), _mm_add_ps(_mm_mul_ps(vz, m10), m14));
+				__m128 cw = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, m3), _mm_mul_ps(vy, m7)), _mm_add_ps(_mm_mul_ps(vz, m11), m15));
+				__m128 inverseW = _mm_div_ps(one, cw);
+				_mm_storeu_ps(rx + i, _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(cx, inverseW), one), scaleX), offsetX));
+				_mm_storeu_ps(ry + i, _mm_add_ps(_mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(cy, inverseW)), scaleY), offsetY));
+				_mm_storeu_ps(rz + i, _mm_mul_ps(_mm_mul_ps(cz, inverseW), half));
+			}
+		}
+#endif
+		for (; i < end; i++) {
+			float cx = x[i] * m[0] + y[i] * m[4] + z[i] * m[8] + m[12];
+			float cy = x[i] * m[1] + y[i] * m[5] + z[i] * m[9] + m[13];
+			float cz = x[i] * m[2] + y[i] * m[6] + z[i] * m[10] + m[14];
+			float cw = x[i] * m[3] + y[i] * m[7] + z[i] * m[11] + m[15];
+			float inverseW = 1 / cw;
+			rx[i] = (cx * inverseW + 1) * halfWidth + viewport.x;
+			ry[i] = (1 - cy * inverseW) * halfHeight + viewport.y;
+			rz[i] = cz * inverseW / 2;
+		}
+	}
+}
+
+void project(const PositionBuffer& positions, const ofCamera& camera, ofRectangle viewport, PositionBuffer& result, bool multiThreaded) {
+	project(positions, camera.getModelViewProjectionMatrix(viewport), viewport, result, multiThreaded);
+}
+
+// same mapping as project(ofMesh&, ...), but reads from positions and writes into
+// result, which is only reallocated when its size does not match
+void project(const PositionBuffer& positions, const ofMatrix4x4& modelViewProjectionMatrix, ofRectangle viewport, PositionBuffer& result, bool multiThreaded) {
+	unsigned int n = positions.size();
+	if (result.size() != n) {
+		result.resize(n);
+	}
+	if (n == 0) {
+		return;
+	}
+	const float* m = modelViewProjectionMatrix.getPtr();
+	size_t grainSize = multiThreaded ? 1 << 14 : n;
+	parallelFor(0, n, [&](size_t begin, size_t end) {
+		projectRange(positions, m, viewport, result, begin, end);
+	}, grainSize);
+}
+
+
+VertexVisibility::VertexVisibility()
+:resolution(.5)
+,depthTolerance(.01)
+,backFaceCulling(false)
+,width(0)
+,height(0) {
+}
+
+void VertexVisibility::setResolution(float resolution) {
+	this->resolution = resolution;
+}
+
+void VertexVisibility::setDepthTolerance(float depthTolerance) {
+	this->depthTolerance = depthTolerance;
+}
+
+void VertexVisibility::setBackFaceCulling(bool backFaceCulling) {
+	this->backFaceCulling = backFaceCulling;
+}
+
+void VertexVisibility::update(const PositionBuffer& positions, const PositionBuffer& projected, const ofMatrix4x4& modelViewProjectionMatrix, const ofVec3f& cameraPosition, const vector<ofIndexType>& triangles, ofRectangle viewport, vector<unsigned int>& visibleIndices) {
+	unsigned int n = positions.size();
+	unsigned int triangleCount = triangles.size() / 3;
+	const float* m = modelViewProjectionMatrix.getPtr();
+
+	// clip space w is the view depth, 1 / w interpolates linearly in screen space
+	inverseDepths.resize(n);
+	parallelFor(0, n, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			float w = positions.x[i] * m[3] + positions.y[i] * m[7] + positions.z[i] * m[11] + m[15];
+			bool clipped = w <= 0 || projected.z[i] < -.5 || projected.z[i] > .5;
+			inverseDepths[i] = clipped ? 0 : 1 / w;
+		}
+	});
+
+	// faces touching clipped vertices are skipped, and so are back faces, which point
+	// away from the camera, when culling them
+	frontFaces.resize(triangleCount);
+	parallelFor(0, triangleCount, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			ofIndexType a = triangles[i * 3], b = triangles[i * 3 + 1], c = triangles[i * 3 + 2];
+			if (inverseDepths[a] == 0 || inverseDepths[b] == 0 || inverseDepths[c] == 0) {
+				frontFaces[i] = false;
+				continue;
+			}
+			if (!backFaceCulling) {
+				frontFaces[i] = true;
+				continue;
+			}
+			ofVec3f pa(positions.x[a], positions.y[a], positions.z[a]);
+			ofVec3f pb(positions.x[b], positions.y[b], positions.z[b]);
+			ofVec3f pc(positions.x[c], positions.y[c], positions.z[c]);
+			ofVec3f normal = (pb - pa).getCrossed(pc - pa);
+			frontFaces[i] = normal.dot(cameraPosition - pa) > 0;
+		}
+	});
+	frontTriangles.clear();
+	frontVertices.assign(n, false);
+	for (unsigned int i = 0; i < triangleCount; i++) {
+		if (frontFaces[i]) {
+			frontTriangles.push_back(i);
+			frontVertices[triangles[i * 3]] = true;
+			frontVertices[triangles[i * 3 + 1]] = true;
+			frontVertices[triangles[i * 3 + 2]] = true;
+		}
+	}
+
+	width = max(1, (int) ceil(viewport.width * resolution));
+	height = max(1, (int) ceil(viewport.height * resolution));
+	depthBuffer.assign(width * height, 0);
+
+	// bin every front face into the bands of rows it overlaps once, a counting sort
+	// by band, so each band only walks its own triangles instead of all of them
+	const int bandHeight = 16;
+	int bands = (height + bandHeight - 1) / bandHeight;
+	unsigned int frontCount = frontTriangles.size();
+	triangleBands.resize(frontCount * 2);
+	bandStarts.assign(bands + 1, 0);
+	for (unsigned int i = 0; i < frontCount; i++) {
+		unsigned int triangle = frontTriangles[i];
+		float ay = (projected.y[triangles[triangle * 3]] - viewport.y) * resolution;
+		float by = (projected.y[triangles[triangle * 3 + 1]] - viewport.y) * resolution;
+		float cy = (projected.y[triangles[triangle * 3 + 2]] - viewport.y) * resolution;
+		int minY = max(0, (int) floor(min(ay, min(by, cy))));
+		int maxY = min(height - 1, (int) ceil(max(ay, max(by, cy))));
+		// an empty range when the triangle is above or below the buffer
+		unsigned int firstBand = minY / bandHeight, lastBand = maxY < minY ? firstBand : maxY / bandHeight + 1;
+		triangleBands[i * 2] = firstBand;
+		triangleBands[i * 2 + 1] = lastBand;
+		for (unsigned int band = firstBand; band < lastBand; band++) {
+			bandStarts[band + 1]++;
+		}
+	}
+	for (int band = 0; band < bands; band++) {
+		bandStarts[band + 1] += bandStarts[band];
+	}
+	bandTriangles.resize(bandStarts[bands]);
+	vector<unsigned int> bandEnds(bandStarts.begin(), bandStarts.end() - 1);
+	for (unsigned int i = 0; i < frontCount; i++) {
+		for (unsigned int band = triangleBands[i * 2]; band < triangleBands[i * 2 + 1]; band++) {
+			bandTriangles[bandEnds[band]++] = frontTriangles[i];
+		}
+	}
+
+	// bands don't share rows, so they are rasterized in parallel without locking
+	parallelFor(0, bands, [&](size_t bandBegin, size_t bandEnd) {
+		for (size_t band = bandBegin; band < bandEnd; band++) {
+			int rowBegin = band * bandHeight, rowEnd = min(height, rowBegin + bandHeight);
+			for (unsigned int i = bandStarts[band]; i < bandStarts[band + 1]; i++) {
+				rasterize(bandTriangles[i], triangles, projected, viewport, rowBegin, rowEnd);
+			}
+		}
+	}, 1);
+
+	// compare against the least occluding pixel around each vertex, so vertices
+	// on silhouettes and thin triangles are not rejected by their own faces
+	visible.resize(n);
+	parallelFor(0, n, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			visible[i] = false;
+			if (!frontVertices[i] || !viewport.inside(projected.x[i], projected.y[i])) {
+				continue;
+			}
+			int x = (projected.x[i] - viewport.x) * resolution;
+			int y = (projected.y[i] - viewport.y) * resolution;
+			float occluder = numeric_limits<float>::max();
+			for (int ny = max(0, y - 1); ny <= min(height - 1, y + 1); ny++) {
+				for (int nx = max(0, x - 1); nx <= min(width - 1, x + 1); nx++) {
+					occluder = min(occluder, depthBuffer[ny * width + nx]);
+				}
+			}
+			visible[i] = inverseDepths[i] * (1 + depthTolerance) >= occluder;
+		}
+	});
+
+	visibleIndices.clear();
+	for (unsigned int i = 0; i < n; i++) {
+		if (visible[i]) {
+			visibleIndices.push_back(i);
+		}
+	}
+}
+
+void VertexVisibility::rasterize(unsigned int triangle, const vector<ofIndexType>& triangles, const PositionBuffer& projected, const ofRectangle& viewport, int rowBegin, int rowEnd) {
+	ofIndexType a = triangles[triangle * 3], b = triangles[triangle * 3 + 1], c = triangles[triangle * 3 + 2];
+	float ax = (projected.x[a] - viewport.x) * resolution, ay = (projected.y[a] - viewport.y) * resolution;
+	float bx = (projected.x[b] - viewport.x) * resolution, by = (projected.y[b] - viewport.y) * resolution;
+	float cx = (projected.x[c] - viewport.x) * resolution, cy = (projected.y[c] - viewport.y) * resolution;
+
+	int minY = max(rowBegin, (int) floor(min(ay, min(by, cy))));
+	int maxY = min(rowEnd - 1, (int) ceil(max(ay, max(by, cy))));
+	int minX = max(0, (int) floor(min(ax, min(bx, cx))));
+	int maxX = min(width - 1, (int) ceil(max(ax, max(bx, cx))));
+	if (minY > maxY || minX > maxX) {
+		return;
+	}
+	float area = (bx - ax) * (cy - ay) - (by - ay) * (cx - ax);
+	if (area == 0) {
+		return;
+	}
+	float inverseArea = 1 / area;
+	float da = inverseDepths[a], db = inverseDepths[b], dc = inverseDepths[c];
+	for (int y = minY; y <= maxY; y++) {
+		float py = y + .5;
+		for (int x = minX; x <= maxX; x++) {
+			float px = x + .5;
+			// barycentric weights, all positive inside regardless of winding
+			float wa = ((bx - px) * (cy - py) - (by - py) * (cx - px)) * inverseArea;
+			float wb = ((cx - px) * (ay - py) - (cy - py) * (ax - px)) * inverseArea;
+			float wc = 1 - wa - wb;
+			if (wa < 0 || wb < 0 || wc < 0) {
+				continue;
+			}
+			float depth = wa * da + wb * db + wc * dc;
+			float& nearest = depthBuffer[y * width + x];
+			if (depth > nearest) {
+				nearest = depth;
+			}
+		}
+	}
+}
@@ -3,6 +3,90 @@
 #include "ofMain.h"
 #include "ofxAssimpModelLoader.h"
 
+/*
+ VertexIndex is a k-d tree over a fixed set of vertices. Build it once per mesh
+ with setup() and share it between everything that needs nearest, k-nearest or
+ radius queries. Results are indices into the vertex array passed to setup().
+*/
+
+class VertexIndex {
+public:
+	void setup(const vector<ofVec3f>& vertices, bool multiThreaded = true);
+	void clear();
+	unsigned int size() const;
+
+	int findNearest(const ofVec3f& base) const;
+	vector<unsigned int> findNearest(const ofVec3f& base, unsigned int k) const;
+	vector<unsigned int> findWithinRadius(const ofVec3f& base, float radius) const;
+
+private:
+	void searchNearest(unsigned int begin, unsigned int end, const ofVec3f& base, int& nearestIndex, float& nearestDistance) const;
+	void searchNearest(unsigned int begin, unsigned int end, const ofVec3f& base, unsigned int k, vector<pair<float, unsigned int> >& heap) const;
+	void searchRadius(unsigned int begin, unsigned int end, const ofVec3f& base, float squareRadius, vector<unsigned int>& result) const;
+
+	// vertices are stored in tree order, indices maps them back to the caller's order
+	vector<ofVec3f> vertices;
+	vector<unsigned int> indices;
+	vector<unsigned char> splitAxes;
+};
+
+/*
+ PositionBuffer holds vertex positions as a structure of arrays, so the batch
+ version of project() can transform four or eight vertices per instruction.
+*/
+
+class PositionBuffer {
+public:
+	void setup(const vector<ofVec3f>& vertices);
+	void resize(unsigned int n);
+	unsigned int size() const;
+
+	vector<float> x, y, z;
+};
+
+/*
+ VertexVisibility finds the vertices of a projected, indexed triangle mesh that
+ can be seen from the camera. The triangles are rasterized into a reduced
+ resolution CPU depth buffer, and a vertex counts as visible when it belongs to
+ at least one rasterized triangle and nothing in the depth buffer is in front
+ of it. Back faces are only skipped when back face culling is enabled, since
+ scans with inconsistent winding or seen from inside would lose vertices.
+*/
+
+class VertexVisibility {
+public:
+	VertexVisibility();
+
+	// size of the depth buffer relative to the viewport
+	void setResolution(float resolution);
+	// relative depth difference tolerated before a vertex counts as occluded
+	void setDepthTolerance(float depthTolerance);
+	// skip triangles that face away from the camera, for meshes with counter clockwise
+	// front faces seen from outside. off by default
+	void setBackFaceCulling(bool backFaceCulling);
+
+	// positions are the world space vertices, projected the output of project() for the same
+	// matrix and viewport. visibleIndices is overwritten with the visible vertices in order.
+	void update(const PositionBuffer& positions, const PositionBuffer& projected, const ofMatrix4x4& modelViewProjectionMatrix, const ofVec3f& cameraPosition, const vector<ofIndexType>& triangles, ofRectangle viewport, vector<unsigned int>& visibleIndices);
+
+private:
+	void rasterize(unsigned int triangle, const vector<ofIndexType>& triangles, const PositionBuffer& projected, const ofRectangle& viewport, int rowBegin, int rowEnd);
+
+	float resolution, depthTolerance;
+	bool backFaceCulling;
+	int width, height;
+	vector<float> depthBuffer; // nearest 1 / w per pixel, 0 where empty
+	vector<float> inverseDepths; // 1 / w per vertex, 0 when clipped
+	vector<unsigned char> frontFaces, frontVertices, visible;
+	vector<unsigned int> frontTriangles;
+	// front triangles binned by the bands of rows they overlap, band i holds
+	// bandTriangles[bandStarts[i]] up to bandTriangles[bandStarts[i + 1]]
+	vector<unsigned int> bandStarts, bandTriangles, triangleBands;
+};
+
 int findNearestVertex(const vector<ofVec3f>& vertices, const ofVec3f& base);
-ofMesh mergeNearbyVertices(const ofMesh& mesh, float tolerance = 0);
+int findNearestVertex(const VertexIndex& index, const ofVec3f& base);
+ofMesh mergeNearbyVertices(const ofMesh& mesh, float tolerance = 0, bool multiThreaded = true);
 void project(ofMesh& mesh, const ofCamera& camera, ofRectangle viewport);
+void project(const PositionBuffer& positions, const ofCamera& camera, ofRectangle viewport, PositionBuffer& result, bool multiThreaded = true);
+void project(const PositionBuffer& positions, const ofMatrix4x4& modelViewProjectionMatrix, ofRectangle viewport, PositionBuffer& result, bool multiThreaded = true);
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "ofMain.h"
+
+/*
+ PointGrid buckets 2d points into a uniform grid of square cells, so a radius
+ query only has to look at the few cells around it instead of every point.
+ Items are opaque indices; the grid stores them sorted by cell using a counting
+ sort, and returns query candidates in ascending item order.
+*/
+
+class PointGrid {
+public:
+	PointGrid()
+	:cols(0)
+	,rows(0)
+	,cellSize(1) {
+	}
+
+	// position(item) returns the ofVec2f for an item, items with non-finite positions are left out
+	template <class Position>
+	void setup(const vector<unsigned int>& items, float minCellSize, Position position) {
+		cellItems.clear();
+		cellStarts.clear();
+		cols = rows = 0;
+
+		ofVec2f min, max;
+		bool empty = true;
+		for (unsigned int i = 0; i < items.size(); i++) {
+			ofVec2f cur = position(items[i]);
+			if (!isfinite(cur.x) || !isfinite(cur.y)) {
+				continue;
+			}
+			if (empty) {
+				min = max = cur;
+				empty = false;
+			} else {
+				min.x = std::min(min.x, cur.x);
+				min.y = std::min(min.y, cur.y);
+				max.x = std::max(max.x, cur.x);
+				max.y = std::max(max.y, cur.y);
+			}
+		}
+		if (empty) {
+			return;
+		}
+
+		// grow the cells until the grid stays proportional to the number of items
+		origin = min;
+		cellSize = std::max(minCellSize, 1e-3f);
+		double maxCells = std::max<double>(1024, items.size() * 4.);
+		while (true) {
+			double c = floor((max.x - min.x) / cellSize) + 1;
+			double r = floor((max.y - min.y) / cellSize) + 1;
+			if (c * r <= maxCells) {
+				cols = c;
+				rows = r;
+				break;
+			}
+			cellSize *= 2;
+		}
+
+		cellStarts.assign(cols * rows + 1, 0);
+		cellOfItem.resize(items.size());
+		for (unsigned int i = 0; i < items.size(); i++) {
+			ofVec2f cur = position(items[i]);
+			if (!isfinite(cur.x) || !isfinite(cur.y)) {
+				cellOfItem[i] = -1;
+				continue;
+			}
+			int cell = getRow(cur.y) * cols + getCol(cur.x);
+			cellOfItem[i] = cell;
+			cellStarts[cell + 1]++;
+		}
+		for (unsigned int cell = 0; cell < cols * rows; cell++) {
+			cellStarts[cell + 1] += cellStarts[cell];
+		}
+		cellItems.resize(cellStarts.back());
+		cellFill.assign(cellStarts.begin(), cellStarts.end() - 1);
+		for (unsigned int i = 0; i < items.size(); i++) {
+			if (cellOfItem[i] != -1) {
+				cellItems[cellFill[cellOfItem[i]]++] = items[i];
+			}
+		}
+	}
+
+	// overwrites result with all items in cells touching the square around center
+	void getCandidates(const ofVec2f& center, float radius, vector<unsigned int>& result) const {
+		result.clear();
+		if (cols == 0 || rows == 0) {
+			return;
+		}
+		float left = (center.x - radius - origin.x) / cellSize, right = (center.x + radius - origin.x) / cellSize;
+		float top = (center.y - radius - origin.y) / cellSize, bottom = (center.y + radius - origin.y) / cellSize;
+		if (!(right >= 0 && bottom >= 0 && left < cols && top < rows)) {
+			return;
+		}
+		int colBegin = std::max(0, (int) floor(left)), colEnd = std::min((int) cols - 1, (int) floor(right));
+		int rowBegin = std::max(0, (int) floor(top)), rowEnd = std::min((int) rows - 1, (int) floor(bottom));
+		for (int row = rowBegin; row <= rowEnd; row++) {
+			for (int col = colBegin; col <= colEnd; col++) {
+				int cell = row * cols + col;
+				result.insert(result.end(), cellItems.begin() + cellStarts[cell], cellItems.begin() + cellStarts[cell + 1]);
+			}
+		}
+		sort(result.begin(), result.end());
+	}
+
+private:
+	unsigned int getCol(float x) const {
+		return std::min<unsigned int>(cols - 1, (x - origin.x) / cellSize);
+	}
+	unsigned int getRow(float y) const {
+		return std::min<unsigned int>(rows - 1, (y - origin.y) / cellSize);
+	}
+
+	unsigned int cols, rows;
+	float cellSize;
+	ofVec2f origin;
+	vector<unsigned int> cellStarts, cellItems, cellFill;
+	vector<int> cellOfItem;
+};
@@ -2,14 +2,322 @@
 
 #include "EventWatcher.h"
 #include "DraggablePoint.h"
+#include "PointGrid.h"
+#include "DynamicBitset.h"
+#include "ThreadPool.h"
+#include "MeshUtils.h"
+
+#ifndef STRINGIFY
+#define STRINGIFY(x) #x
+#endif
 
 class SelectablePoints : public EventWatcher {
 protected:
-	vector<DraggablePoint> points;
-	set<unsigned int> selected;
+	// per-point state as a structure of arrays, see DraggablePoint for the flags;
+	// selection and marks are bitsets so they can be listed without visiting every point.
+	// positions is a PositionBuffer so project() can write into it directly, z is unused
+	PositionBuffer positions;
+	vector<ofVec2f> positionsStart;
+	vector<unsigned char> flags;
+	DynamicBitset selected, marked;
+
+	// when useSubset is set, only the points listed in subset are drawn and hit tested
+	vector<unsigned int> subset;
+	bool useSubset;
 	
 	bool allowMultiSelect, autoMark;
 
+	unsigned int activeSize() {
+		if (lodCellSize > 0) {
+			return lodPoints.size();
+		}
+		return useSubset ? subset.size() : size();
+	}
+	unsigned int activeIndex(unsigned int i) {
+		if (lodCellSize > 0) {
+			return lodPoints[i];
+		}
+		return useSubset ? subset[i] : i;
+	}
+
+	// level of detail: when lodCellSize is set, the points are bucketed into screen
+	// cells of that many pixels and only the point nearest to each cell center is
+	// drawn and hit tested. selected and marked points are always kept and claim
+	// their cell. the cells are rebuilt in parallel whenever the points or the view
+	// change. the cells are fixed in pixels, so zooming in spreads the points
+	// over more cells and reveals more of them.
+	float lodCellSize;
+	bool lodDirty;
+	ofRectangle lodViewport;
+	vector<unsigned int> lodPoints;
+	std::unique_ptr<std::atomic<uint64_t>[]> lodCells;
+	unsigned int lodCellCount = 0;
+	std::mutex lodMutex;
+
+	void updateLod() {
+		if (lodCellSize <= 0 || (!lodDirty && lodViewport == viewport)) {
+			return;
+		}
+		lodDirty = false;
+		lodViewport = viewport;
+		gridDirty = true;
+		meshDirty = true;
+		lodPoints.clear();
+
+		unsigned int n = useSubset ? subset.size() : size();
+		bool limitToViewport = (viewport != ofRectangle());
+		ofRectangle bounds = viewport;
+		if (!limitToViewport) {
+			bool empty = true;
+			for (unsigned int k = 0; k < n; k++) {
+				ofVec2f cur = getPosition(useSubset ? subset[k] : k);
+				if (isfinite(cur.x) && isfinite(cur.y)) {
+					if (empty) {
+						bounds.set(cur, 0, 0);
+						empty = false;
+					} else {
+						bounds.growToInclude(cur);
+					}
+				}
+			}
+			if (empty) {
+				return;
+			}
+		}
+
+		// grow the cells if the view is huge compared to the number of points
+		float cellSize = lodCellSize;
+		double maxCells = std::max<double>(1024, n * 4.);
+		unsigned int cols, rows;
+		while (true) {
+			double c = floor(bounds.width / cellSize) + 1;
+			double r = floor(bounds.height / cellSize) + 1;
+			if (c * r <= maxCells) {
+				cols = c;
+				rows = r;
+				break;
+			}
+			cellSize *= 2;
+		}
+
+		// each cell keeps the smallest (distance to center, index) key, packed so the
+		// points can race for it with an atomic min. selected and marked points use
+		// a zero distance field, which claims the cell ahead of every other point.
+		const uint64_t emptyCell = ~uint64_t(0);
+		if (lodCellCount < cols * rows) {
+			lodCellCount = cols * rows;
+			lodCells.reset(new std::atomic<uint64_t>[lodCellCount]);
+		}
+		parallelFor(0, cols * rows, [&](size_t begin, size_t end) {
+			for (size_t cell = begin; cell < end; cell++) {
+				lodCells[cell].store(emptyCell, std::memory_order_relaxed);
+			}
+		}, 16384);
+		parallelFor(0, n, [&](size_t begin, size_t end) {
+			vector<unsigned int> kept;
+			for (size_t k = begin; k < end; k++) {
+				unsigned int i = useSubset ? subset[k] : k;
+				ofVec2f cur = getPosition(i);
+				if (!isfinite(cur.x) || !isfinite(cur.y) || (limitToViewport && !viewport.inside(cur))) {
+					continue;
+				}
+				float x = (cur.x - bounds.x) / cellSize, y = (cur.y - bounds.y) / cellSize;
+				unsigned int col = std::min<unsigned int>(cols - 1, x), row = std::min<unsigned int>(rows - 1, y);
+				uint64_t key = i;
+				if (selected.test(i) || marked.test(i)) {
+					kept.push_back(i);
+				} else {
+					float dx = x - (col + .5f), dy = y - (row + .5f);
+					float distance = dx * dx + dy * dy;
+					uint32_t distanceBits;
+					memcpy(&distanceBits, &distance, sizeof(distanceBits));
+					key |= uint64_t(distanceBits + 1) << 32;
+				}
+				std::atomic<uint64_t>& cell = lodCells[row * cols + col];
+				uint64_t previous = cell.load(std::memory_order_relaxed);
+				while (key < previous && !cell.compare_exchange_weak(previous, key, std::memory_order_relaxed)) {
+				}
+			}
+			if (!kept.empty()) {
+				std::lock_guard<std::mutex> lock(lodMutex);
+				lodPoints.insert(lodPoints.end(), kept.begin(), kept.end());
+			}
+		}, 65536);
+		for (unsigned int cell = 0; cell < cols * rows; cell++) {
+			uint64_t key = lodCells[cell].load(std::memory_order_relaxed);
+			if (key != emptyCell && (key >> 32) != 0) {
+				lodPoints.push_back(key & 0xffffffff);
+			}
+		}
+		sort(lodPoints.begin(), lodPoints.end());
+	}
+
+	// screen space grid over the active points, rebuilt on the next click after any change
+	PointGrid grid;
+	bool gridDirty;
+	ofRectangle gridViewport;
+	vector<unsigned int> gridItems, gridCandidates;
+
+	void updateGrid() {
+		updateLod();
+		if (!gridDirty && gridViewport == viewport) {
+			return;
+		}
+		gridDirty = false;
+		gridViewport = viewport;
+		bool limitToViewport = (viewport != ofRectangle());
+		gridItems.clear();
+		for (unsigned int active = 0; active < activeSize(); active++) {
+			if (!limitToViewport || viewport.inside(getPosition(activeIndex(active)))) {
+				gridItems.push_back(active);
+			}
+		}
+		grid.setup(gridItems, sqrt(sizes[DraggablePoint::SIZE_CLICK_RADIUS_SQUARED]), [this](unsigned int active) {
+			return getPosition(activeIndex(active));
+		});
+	}
+
+	// the unselected dots are drawn in a single call as round point sprites, by a
+	// small shader that reads the positions straight from a buffer. dotIndices lists
+	// them and is only rebuilt when the selection or the active points change, a move
+	// of the points only uploads the positions again and a change of the marks only
+	// the marks
+	ofShader dotShader;
+	ofBufferObject dotPositionsX, dotPositionsY, dotMarks, dotIndexBuffer;
+	vector<unsigned int> dotIndices;
+	vector<float> marks;
+	bool meshDirty, positionsDirty, marksDirty;
+	vector<unsigned int> visibleSelected;
+
+	void updateDotMesh() {
+		updateLod();
+		unsigned int n = size();
+		if (n == 0) {
+			return;
+		}
+		if (meshDirty) {
+			meshDirty = false;
+			dotIndices.clear();
+			visibleSelected.clear();
+			for (unsigned int active = 0; active < activeSize(); active++) {
+				unsigned int i = activeIndex(active);
+				if (isSelected(i)) {
+					visibleSelected.push_back(i);
+				} else {
+					dotIndices.push_back(i);
+				}
+			}
+			if (!dotIndices.empty()) {
+				dotIndexBuffer.allocate(dotIndices.size() * sizeof(unsigned int), &dotIndices[0], GL_DYNAMIC_DRAW);
+			}
+		}
+		if (positionsDirty) {
+			positionsDirty = false;
+			dotPositionsX.allocate(n * sizeof(float), &positions.x[0], GL_DYNAMIC_DRAW);
+			dotPositionsY.allocate(n * sizeof(float), &positions.y[0], GL_DYNAMIC_DRAW);
+		}
+		if (marksDirty) {
+			marksDirty = false;
+			marks.resize(n);
+			for (unsigned int i = 0; i < n; i++) {
+				marks[i] = isMarked(i);
+			}
+			dotMarks.allocate(n * sizeof(float), &marks[0], GL_DYNAMIC_DRAW);
+		}
+	}
+
+	enum { POSITION_X_LOCATION, POSITION_Y_LOCATION, MARK_LOCATION };
+
+	void setupDotShader() {
+		dotShader.setupShaderFromSource(GL_VERTEX_SHADER, dotVertexShader);
+		dotShader.setupShaderFromSource(GL_FRAGMENT_SHADER, dotFragmentShader);
+		// a position is attribute 0, which older drivers need to draw anything
+		dotShader.bindAttribute(POSITION_X_LOCATION, "positionX");
+		dotShader.bindAttribute(POSITION_Y_LOCATION, "positionY");
+		dotShader.bindAttribute(MARK_LOCATION, "mark");
+		dotShader.linkProgram();
+	}
+
+	void drawDots() {
+		if (dotIndices.empty()) {
+			return;
+		}
+		if (!dotShader.isLoaded()) {
+			setupDotShader();
+		}
+		bool limitToViewport = (viewport != ofRectangle());
+		float radius = sizes[DraggablePoint::SIZE_DOT_RADIUS];
+		dotShader.begin();
+		dotShader.setUniform1f("pointSize", 2 * radius);
+		dotShader.setUniform4f("bounds", viewport.getLeft(), viewport.getTop(), viewport.getRight(), viewport.getBottom());
+		dotShader.setUniform1f("limitToBounds", limitToViewport ? 1 : 0);
+		dotShader.setUniform4f("normalColor", ofFloatColor(colors[DraggablePoint::COLOR_NORMAL]));
+		dotShader.setUniform4f("markedColor", ofFloatColor(colors[DraggablePoint::COLOR_MARKED]));
+		ofEnablePointSprites();
+		glEnable(GL_VERTEX_PROGRAM_POINT_SIZE);
+
+		dotPositionsX.bind(GL_ARRAY_BUFFER);
+		glEnableVertexAttribArray(POSITION_X_LOCATION);
+		glVertexAttribPointer(POSITION_X_LOCATION, 1, GL_FLOAT, GL_FALSE, 0, 0);
+		dotPositionsY.bind(GL_ARRAY_BUFFER);
+		glEnableVertexAttribArray(POSITION_Y_LOCATION);
+		glVertexAttribPointer(POSITION_Y_LOCATION, 1, GL_FLOAT, GL_FALSE, 0, 0);
+		dotMarks.bind(GL_ARRAY_BUFFER);
+		glEnableVertexAttribArray(MARK_LOCATION);
+		glVertexAttribPointer(MARK_LOCATION, 1, GL_FLOAT, GL_FALSE, 0, 0);
+		dotIndexBuffer.bind(GL_ELEMENT_ARRAY_BUFFER);
+		glDrawElements(GL_POINTS, dotIndices.size(), GL_UNSIGNED_INT, 0);
+		dotIndexBuffer.unbind(GL_ELEMENT_ARRAY_BUFFER);
+		glDisableVertexAttribArray(MARK_LOCATION);
+		glDisableVertexAttribArray(POSITION_Y_LOCATION);
+		glDisableVertexAttribArray(POSITION_X_LOCATION);
+		dotMarks.unbind(GL_ARRAY_BUFFER);
+
+		glDisable(GL_VERTEX_PROGRAM_POINT_SIZE);
+		ofDisablePointSprites();
+		dotShader.end();
+	}
+
+	string dotVertexShader = STRINGIFY(
+		#version 120\n
+
+		attribute float positionX;
+		attribute float positionY;
+		attribute float mark;
+
+		uniform float pointSize;
+		uniform vec4 bounds; // left, top, right, bottom
+		uniform float limitToBounds;
+		uniform vec4 normalColor;
+		uniform vec4 markedColor;
+
+		void main()
+		{
+			vec2 position = vec2(positionX, positionY);
+			gl_FrontColor = mix(normalColor, markedColor, mark);
+			gl_PointSize = pointSize;
+			gl_Position = gl_ModelViewProjectionMatrix * vec4(position, 0., 1.);
+			if (limitToBounds > 0. && (any(lessThan(position, bounds.xy)) || any(greaterThan(position, bounds.zw)))) {
+				// outside of the clip volume, so the point is dropped
+				gl_Position = vec4(2., 2., 2., 1.);
+			}
+		}
+	);
+
+	string dotFragmentShader = STRINGIFY(
+		#version 120\n
+
+		void main()
+		{
+			vec2 offset = gl_PointCoord * 2. - 1.;
+			if (dot(offset, offset) > 1.) {
+				discard;
+			}
+			gl_FragColor = gl_Color;
+		}
+	);
+
+	// theme shared by all points
 	// { SIZE_CLICK_RADIUS_SQUARED, SIZE_DOT_RADIUS, SIZE_SELECTED_DOT_RADIUS, SIZE_SELECTED_CIRCLE_RADIUS, SIZE_SELECTED_CIRCLE_THICKNESS };
 	vector<float> sizes = { 64, 4., 1., 10., 2. };
 	// { COLOR_NORMAL, COLOR_MARKED, COLOR_SELECTED, COLOR_CROSSHAIR };
@@ -17,7 +325,15 @@ protected:
 
 public:
 	SelectablePoints()
-	:allowMultiSelect(true)
+	:useSubset(false)
+	,allowMultiSelect(true)
+	,autoMark(true)
+	,lodCellSize(0)
+	,lodDirty(true)
+	,gridDirty(true)
+	,meshDirty(true)
+	,positionsDirty(true)
+	,marksDirty(true)
 	,pointsChanged(false) {
 	}
 
@@ -25,90 +341,196 @@ public:
 	ofRectangle viewport;
 
 	unsigned int size() {
-		return points.size();
+		return flags.size();
 	}
 	void add(const ofVec2f& v) {
-		points.push_back(DraggablePoint());
-		points.back().setAutoMark(autoMark);
-		points.back().position = v;
-		points.back().setTheme(sizes, colors);
+		positions.x.push_back(v.x);
+		positions.y.push_back(v.y);
+		positions.z.push_back(0);
+		positionsStart.push_back(v);
+		flags.push_back(autoMark ? DraggablePoint::FLAG_AUTO_MARK : 0);
+		selected.push_back(false);
+		marked.push_back(false);
 		pointsChanged = true;
+		gridDirty = true;
+		meshDirty = true;
+		positionsDirty = true;
+		marksDirty = true;
+		lodDirty = true;
 	}
+	// moves the last point into the removed slot, so only that point changes its
+	// index; the selection and marks of all other points are kept
 	void remove(unsigned int index) {
-		points.erase(points.begin() + index);
-		selected.clear();
+		unsigned int last = size() - 1;
+		positions.x[index] = positions.x[last];
+		positions.y[index] = positions.y[last];
+		positionsStart[index] = positionsStart[last];
+		flags[index] = flags[last];
+		positions.resize(last);
+		positionsStart.pop_back();
+		flags.pop_back();
+		selected.swapRemove(index);
+		marked.swapRemove(index);
+		for (auto itr = subset.begin(); itr != subset.end();) {
+			if (*itr == index) {
+				itr = subset.erase(itr);
+			} else {
+				if (*itr == last) {
+					*itr = index;
+				}
+				itr++;
+			}
+		}
+		pointsChanged = true;
+		gridDirty = true;
+		meshDirty = true;
+		positionsDirty = true;
+		marksDirty = true;
+		lodDirty = true;
+	}
+	ofVec2f getPosition(unsigned int i) const {
+		return ofVec2f(positions.x[i], positions.y[i]);
+	}
+	void setPosition(unsigned int i, const ofVec2f& position) {
+		positions.x[i] = position.x;
+		positions.y[i] = position.y;
+		pointsChanged = true;
+		gridDirty = true;
+		positionsDirty = true;
+		lodDirty = true;
+	}
+	// for writing all positions in place, e.g. by passing it as the result of
+	// project(). call updatePositions() afterwards
+	PositionBuffer& getPositions() {
+		return positions;
+	}
+	void updatePositions() {
+		if (positions.size() != size()) {
+			ofLogError("SelectablePoints") << "updatePositions() needs " << size() << " positions, got " << positions.size();
+			positions.resize(size());
+		}
 		pointsChanged = true;
+		gridDirty = true;
+		positionsDirty = true;
+		lodDirty = true;
 	}
-	DraggablePoint& get(int i) {
-		return points[i];
+	bool isSelected(unsigned int index) {
+		return selected.test(index);
 	}
 	void setSelected(unsigned int index, bool select) {
-		if (points[index].selected && !select) {
-			selected.erase(index);
-		} else if (!points[index].selected && select) {
-			selected.insert(index);
+		selected.set(index, select);
+		meshDirty = true;
+		lodDirty = true;
+	}
+	bool isMarked(unsigned int index) {
+		return marked.test(index);
+	}
+	void setMarked(unsigned int index, bool mark = true) {
+		marked.set(index, mark);
+		marksDirty = true;
+		lodDirty = true;
+	}
+	void setFlag(unsigned int index, unsigned char flag, bool value) {
+		if (value) {
+			flags[index] |= flag;
+		} else {
+			flags[index] &= ~flag;
 		}
-		points[index].selected = select;
 	}
 
+	// both in ascending order
 	vector<unsigned int> getSelected() {
 		vector<unsigned int> result;
-		std::copy(selected.begin(), selected.end(), std::back_inserter(result));
+		selected.getSetBits(result);
 		return result;
 	}
 	vector<unsigned int> getMarked() {
 		vector<unsigned int> result;
-		for (auto itr = points.begin(); itr != points.end(); itr++) {
-			if ((*itr).marked) {
-				result.push_back(itr - points.begin());
-			}
-		}
+		marked.getSetBits(result);
 		return result;
 	}
 	void clear() {
-		points.clear();
+		positions.resize(0);
+		positionsStart.clear();
+		flags.clear();
 		selected.clear();
+		marked.clear();
+		subset.clear();
+		useSubset = false;
 		pointsChanged = true;
+		gridDirty = true;
+		meshDirty = true;
+		positionsDirty = true;
+		marksDirty = true;
+		lodDirty = true;
+	}
+	// restricts drawing and hit testing to the given indices, e.g. the visible points
+	void setSubset(const vector<unsigned int>& indices) {
+		subset = indices;
+		useSubset = true;
+		gridDirty = true;
+		meshDirty = true;
+		lodDirty = true;
+	}
+	void clearSubset() {
+		subset.clear();
+		useSubset = false;
+		gridDirty = true;
+		meshDirty = true;
+		lodDirty = true;
 	}
 	void deselectAll(bool keepMark = true) {
-		for (auto itr = points.begin(); itr != points.end(); itr++) {
-			(*itr).selected = false;
-			if (!keepMark) {
-				(*itr).marked = false;
-			}
+		selected.reset();
+		if (!keepMark) {
+			marked.reset();
+			marksDirty = true;
+		}
+		meshDirty = true;
+		lodDirty = true;
+	}
+	// 0 disables the level of detail, see updateLod()
+	void setLodCellSize(float cellSize) {
+		if (cellSize != lodCellSize) {
+			lodCellSize = cellSize;
+			lodDirty = true;
+			gridDirty = true;
+			meshDirty = true;
 		}
-		selected.clear();
 	}
 	void setAllowMultiSelect(bool allow) {
 		this->allowMultiSelect = allow;
 	}
 	void setAutoMark(bool flag) {
 		this->autoMark = flag;
-		for (set<unsigned int>::iterator itr = selected.begin(); itr != selected.end(); itr++) {
-			points[*itr].autoMark = flag;
+		vector<unsigned int> selectedPoints = getSelected();
+		for (unsigned int i = 0; i < selectedPoints.size(); i++) {
+			setFlag(selectedPoints[i], DraggablePoint::FLAG_AUTO_MARK, flag);
 		}
 	}
 
 	void setTheme(vector<float> _sizes, vector<ofColor> _colors) {
 		sizes = _sizes;
 		colors = _colors;
-		for (auto itr = points.begin(); itr != points.end(); itr++) {
-			(*itr).setTheme(sizes, colors);
-		}
+		gridDirty = true;
 	}
 
 	void mousePressed(ofMouseEventArgs& mouse) {
 		bool shift = ofGetKeyPressed(OF_KEY_SHIFT) && allowMultiSelect;
 		int nearestPointIndex = -1;
 		float nearestPointDistanceSquared;
-		bool limitToViewport = (viewport != ofRectangle());
-		for(int i = 0; i < size(); i++) {
-			if (limitToViewport && !viewport.inside(points[i].position)) {
-				continue;
+		// only the points in grid cells around the mouse can be hit, they are
+		// visited in the same order as a full scan to keep the nearest-hit result
+		updateGrid();
+		grid.getCandidates(mouse, sqrt(sizes[DraggablePoint::SIZE_CLICK_RADIUS_SQUARED]), gridCandidates);
+		for(unsigned int candidate = 0; candidate < gridCandidates.size(); candidate++) {
+			unsigned int i = activeIndex(gridCandidates[candidate]);
+			ofVec2f position = getPosition(i);
+			bool hit = DraggablePoint::isHit(position, mouse, sizes);
+			if(hit && (flags[i] & DraggablePoint::FLAG_AUTO_MARK)) {
+				setMarked(i);
 			}
-			bool hit = points[i].isHit(mouse);
 			if(hit) {
-				float distanceSquared = points[i].position.distanceSquared(mouse);
+				float distanceSquared = position.distanceSquared(mouse);
 				if (distanceSquared < 1.0) {
 					nearestPointIndex = i;
 					break;
@@ -122,27 +544,33 @@ public:
 		if (!shift) {
 			deselectAll();
 		}
-		if (nearestPointIndex != -1 && !points[nearestPointIndex].selected) {
-			points[nearestPointIndex].selected = true;
-			selected.insert(nearestPointIndex);
+		if (nearestPointIndex != -1 && !isSelected(nearestPointIndex)) {
+			setSelected(nearestPointIndex, true);
 		}
 	}
 	virtual void keyPressed(ofKeyEventArgs& key) {
 		if(key.key == OF_KEY_DEL || key.key == OF_KEY_BACKSPACE) {
-			for(set<unsigned int>::iterator itr = selected.begin(); itr != selected.end(); itr++) {
-				points[*itr].reset();
+			vector<unsigned int> selectedPoints = getSelected();
+			for(unsigned int i = 0; i < selectedPoints.size(); i++) {
+				setFlag(selectedPoints[i], DraggablePoint::FLAG_DRAGGING, false);
+				setMarked(selectedPoints[i], false);
 			}
-			selected.clear();
+			selected.reset();
+			meshDirty = true;
 		}
 	}
 	void draw(ofEventArgs& args) {
+		updateDotMesh();
 		ofPushStyle();
+		drawDots();
+
+		// selected points get their ring and crosshair in a second, small pass
 		bool limitToViewport = (viewport != ofRectangle());
-		for (int i = 0; i < size(); i++) {
-			if (limitToViewport && !viewport.inside(points[i].position)) {
-				continue;
+		for (unsigned int i = 0; i < visibleSelected.size(); i++) {
+			ofVec2f position = getPosition(visibleSelected[i]);
+			if (!limitToViewport || viewport.inside(position)) {
+				DraggablePoint::draw(position, true, isMarked(visibleSelected[i]), sizes, colors, viewport);
 			}
-			points[i].draw(viewport);
 		}
 		ofPopStyle();
 	}
@@ -2,162 +2,133 @@
 
 ofxMapamok::ofxMapamok()
 {
-	distortionShader.setupShaderFromSource(GL_VERTEX_SHADER, distortionVertexShader);
-	distortionShader.setupShaderFromSource(GL_FRAGMENT_SHADER, distortionFragmentShader);
-
-	if (ofIsGLProgrammableRenderer()) {
-		distortionShader.bindDefaults();
-	}
-	distortionShader.linkProgram();
 }
 
 void ofxMapamok::calibrate(ofRectangle vp, vector<cv::Point2f>& imagePoints, vector<cv::Point3f>& objectPoints, int flags, float aov) {
-	int n = imagePoints.size();
-	const static int minPoints = 6;
-	if (n < minPoints) {
-		calibrationReady = false;
-		return;
-	}
+	applySolution(ofxMapamokSolver::solve(makeRequest(vp, imagePoints, objectPoints, flags, aov)));
+}
 
-	vector<cv::Mat> rvecs, tvecs;
-	vector<vector<cv::Point3f> > objectPointsCv;
-	vector<vector<cv::Point2f> > imagePointsCv;
-	cv::Point2f offset(vp.x, vp.y);
-	if (offset == cv::Point2f(0, 0)) {
-		imagePointsCv.push_back(imagePoints);
-	} else {
-		vector<cv::Point2f> offsetPoints;
-		for (auto const& point : imagePoints) {
-			offsetPoints.push_back(point - offset);
-		}
-		imagePointsCv.push_back(offsetPoints);
+unsigned int ofxMapamok::calibrateAsync(ofRectangle vp, const vector<cv::Point2f>& imagePoints, const vector<cv::Point3f>& objectPoints, int flags, float aov) {
+	return solver.request(makeRequest(vp, imagePoints, objectPoints, flags, aov));
+}
+
+ofxMapamokSolver::Request ofxMapamok::makeRequest(ofRectangle vp, const vector<cv::Point2f>& imagePoints, const vector<cv::Point3f>& objectPoints, int flags, float aov) {
+	ofxMapamokSolver::Request request;
+	request.viewport = vp;
+	request.imagePoints = imagePoints;
+	request.objectPoints = objectPoints;
+	request.flags = flags;
+	request.aov = aov;
+	if (incrementalCalibration) {
+		request.warmStart = currentSolution.clone();
+	}
+	request.robust = robustCalibration;
+	request.inlierThreshold = robustInlierThreshold;
+	request.autoModel = autoDistortionModel;
+	return request;
+}
+
+void ofxMapamok::update() {
+	ofxMapamokRuntime::update();
+	ofxMapamokSolver::Solution solution;
+	if (solver.getSolution(solution)) {
+		applySolution(solution);
 	}
-	objectPointsCv.push_back(objectPoints);
-
-	cv::Size2i imageSize(vp.width, vp.height);
-	float f = imageSize.width * ofDegToRad(aov); // this might be wrong, but it's optimized out
-	cv::Point2f c = cv::Point2f(imageSize) * (1. / 2);
-	cv::Mat1d cameraMatrix = (cv::Mat1d(3, 3) <<
-		f, 0, c.x,
-		0, f, c.y,
-		0, 0, 1);
-	cv::Mat distortionCoefficients;
+}
 
-	calibrateCamera(objectPointsCv, imagePointsCv, imageSize, cameraMatrix, distortionCoefficients, rvecs, tvecs, flags);
-	setData(cameraMatrix, rvecs[0], tvecs[0], imageSize, distortionCoefficients);
+bool ofxMapamok::isCalibrating() {
+	return solver.isBusy();
 }
 
-void ofxMapamok::setData(cv::Mat1d cameraMatrix, cv::Mat rotation, cv::Mat translation, cv::Size2i imageSize, cv::Mat distortionCoefficients) {
-	rvec = rotation;
-	tvec = translation;
-	intrinsics.setup(cameraMatrix, imageSize);
-	modelMatrix = makeMatrix(rvec, tvec);
-	distCoeffs = distortionCoefficients;
+float ofxMapamok::getReprojectionError() const {
+	return currentSolution.rms;
+}
 
-	useDistortionShader = false;
-	for (int i = 0; i < distortionCoefficients.cols; i++) {
-		if (distortionCoefficients.at<double>(i) != 0.0) {
-			useDistortionShader = true;
-			break;
-		}
-	}
-	if (useDistortionShader) {
-		distortionShader.begin();
-		distortionShader.setUniform3f("k", ofVec3f(distortionCoefficients.at<double>(0), distortionCoefficients.at<double>(1), distortionCoefficients.at<double>(4)));
-		distortionShader.setUniform2f("p", ofVec2f(distortionCoefficients.at<double>(2), distortionCoefficients.at<double>(3)));
-		distortionShader.setUniform2f("focalLength", ofVec2f(cameraMatrix.at<double>(0, 0), cameraMatrix.at<double>(1, 1)));
-		distortionShader.setUniform2f("principalPoint", ofVec2f(cameraMatrix.at<double>(0, 2), cameraMatrix.at<double>(1, 2)) );
-		distortionShader.end();
-	}
+const vector<float>& ofxMapamok::getResiduals() const {
+	return currentSolution.residuals;
+}
 
-	calibrationReady = true;
+const vector<cv::Point2f>& ofxMapamok::getReprojectedPoints() const {
+	return currentSolution.reprojectedPoints;
 }
 
-void ofxMapamok::setViewport(ofRectangle vp) {
-	if (vp != viewport) {
-		viewport = vp;
-	}
+const vector<unsigned char>& ofxMapamok::getInliers() const {
+	return currentSolution.inliers;
 }
 
+const vector<ofxMapamokSolver::ModelCandidate>& ofxMapamok::getModelCandidates() const {
+	return currentSolution.modelCandidates;
+}
 
-void ofxMapamok::begin() {
-	if (!calibrationReady) {
-		return;
-	}
-	ofPushMatrix();
-	ofSetMatrixMode(OF_MATRIX_PROJECTION);
-	ofPushMatrix();
-	ofSetMatrixMode(OF_MATRIX_MODELVIEW);
-	intrinsics.loadProjectionMatrix(nearDist, farDist);
-	ofMultMatrix(modelMatrix);
-
-	if (!useDistortionShader) {
-		ofViewport(viewport);
+unsigned int ofxMapamok::getSolutionRequestId() const {
+	return currentSolution.requestId;
+}
+
+void ofxMapamok::applySolution(const ofxMapamokSolver::Solution& solution) {
+	if (solution.ready) {
+		setData(solution.cameraMatrix, solution.rvec, solution.tvec, solution.imageSize, solution.distortionCoefficients);
+		currentSolution = solution;
+		ofLogVerbose() << "calibrated in " << solution.solveTime << " ms, rms " << solution.rms << " px" << (solution.poseOnly ? ", pose only" : solution.warmStarted ? ", warm started" : "");
+		for (auto const& candidate : solution.modelCandidates) {
+			ofLogVerbose() << "distortion model " << candidate.name << (candidate.ready ? ", score " + ofToString(candidate.score) : ", failed");
+		}
 	}
 	else {
-		if (distortionBuffer.getWidth() != viewport.width || distortionBuffer.getHeight() != viewport.height) {
-			distortionBuffer.allocate(viewport.width, viewport.height, GL_RGBA);
-		}
-		distortionBuffer.begin(false);
-		ofViewport(ofRectangle(0, 0, viewport.width, viewport.height));
-		ofClear(0, 0);
+		calibrationReady = false;
+		currentSolution = ofxMapamokSolver::Solution();
 	}
-
 }
 
-void ofxMapamok::end() {
-	if (!calibrationReady) {
-		return;
-	}
+void ofxMapamok::setData(cv::Mat1d cameraMatrix, cv::Mat rotation, cv::Mat translation, cv::Size2i imageSize, cv::Mat distortionCoefficients) {
+	// data from outside the solver has no flags to warm start from
+	currentSolution = ofxMapamokSolver::Solution();
+	rvec = rotation;
+	tvec = translation;
+	intrinsics.setup(cameraMatrix, imageSize);
+	distCoeffs = distortionCoefficients;
 
-	if (useDistortionShader) {
-		distortionBuffer.end();
+	CalibrationFile::Calibration calibration;
+	memset(&calibration, 0, sizeof(calibration));
+	for (int i = 0; i < 9; i++) {
+		calibration.cameraMatrix[i] = cameraMatrix.at<double>(i / 3, i % 3);
 	}
-
-	// restore default viewport
-	ofViewport(0, 0, ofGetWidth(), ofGetHeight());
-
-	ofPopMatrix();
-	ofSetMatrixMode(OF_MATRIX_PROJECTION);
-	ofPopMatrix();
-	ofSetMatrixMode(OF_MATRIX_MODELVIEW);
-
-	if (useDistortionShader) {
-		distortionShader.begin();
-		distortionBuffer.draw(viewport.getLeft(), viewport.getBottom(), viewport.width, -viewport.height); // draw FBO upside-down
-		distortionShader.end();
+	for (int i = 0; i < 3; i++) {
+		calibration.rotationVector[i] = rotation.at<double>(i);
+		calibration.translationVector[i] = translation.at<double>(i);
+	}
+	for (int i = 0; i < std::min<int>(distortionCoefficients.total(), 5); i++) {
+		calibration.distortionCoefficients[i] = distortionCoefficients.at<double>(i);
 	}
+	calibration.imageWidth = imageSize.width;
+	calibration.imageHeight = imageSize.height;
+	ofxMapamokRuntime::setData(calibration);
 }
 
-ofVec3f ofxMapamok::worldToScreen(ofVec3f WorldXYZ, ofRectangle viewport) {
-	if (!calibrationReady) {
-		return WorldXYZ;
+void ofxMapamok::setData(const CalibrationFile::Calibration& calibration) {
+	cv::Mat1d cameraMatrix(3, 3);
+	for (int i = 0; i < 9; i++) {
+		cameraMatrix.at<double>(i / 3, i % 3) = calibration.cameraMatrix[i];
 	}
-
-	if (viewport.isZero()) {
-		viewport = ofGetCurrentViewport();
+	cv::Mat rotation = (cv::Mat1d(3, 1) << calibration.rotationVector[0], calibration.rotationVector[1], calibration.rotationVector[2]);
+	cv::Mat translation = (cv::Mat1d(3, 1) << calibration.translationVector[0], calibration.translationVector[1], calibration.translationVector[2]);
+	cv::Mat distortionCoefficients = cv::Mat1d(1, 5);
+	for (int i = 0; i < 5; i++) {
+		distortionCoefficients.at<double>(i) = calibration.distortionCoefficients[i];
 	}
-
-	begin();
-	ofMatrix4x4 modelViewMatrix = ofGetCurrentMatrix(OF_MATRIX_MODELVIEW);
-	ofMatrix4x4 projectionMatrix = ofGetCurrentMatrix(OF_MATRIX_PROJECTION);
-	end();
-
-	ofVec3f CameraXYZ = WorldXYZ * modelViewMatrix * projectionMatrix;
-	ofVec3f ScreenXYZ;
-
-	ScreenXYZ.x = (CameraXYZ.x + 1.0f) / 2.0f * viewport.width + viewport.x;
-	ScreenXYZ.y = (1.0f - CameraXYZ.y) / 2.0f * viewport.height + viewport.y;
-
-	ScreenXYZ.z = CameraXYZ.z;
-
-	return ScreenXYZ;
+	setData(cameraMatrix, rotation, translation, cv::Size2i(calibration.imageWidth, calibration.imageHeight), distortionCoefficients);
 }
 
+bool ofxMapamok::load(string fileName) {
+	if (ofToLower(ofFilePath::getFileExt(fileName)) == "bin") {
+		return ofxMapamokRuntime::load(fileName);
+	}
 
-void ofxMapamok::load(string fileName) {
 	// load the calibration-advanced yml
 	cv::FileStorage fs(ofToDataPath(fileName, true), cv::FileStorage::READ);
+	if (!fs.isOpened()) {
+		ofLogError() << "could not open " << fileName;
+		return false;
+	}
 
 	cv::Mat cameraMatrix;
 	cv::Size2i imageSize;
@@ -172,9 +143,11 @@ void ofxMapamok::load(string fileName) {
 
 	if (imageSize.width != 0 && imageSize.height != 0) {
 		setData(cameraMatrix, rotation, translation, imageSize, distortionCoefficients);
+		return true;
 	}
 	else {
 		ofLogError() << "calibration does not contain image size";
+		return false;
 	}
 }
 
@@ -265,28 +238,12 @@ void ofxMapamok::save(string fileName, string fileNameSummary) {
 }
 
 void ofxMapamok::reset() {
-	calibrationReady = false;
+	solver.cancel();
+	ofxMapamokRuntime::reset();
+	currentSolution = ofxMapamokSolver::Solution();
 
 	rvec = cv::Mat();
 	tvec = cv::Mat();
-	modelMatrix = ofMatrix4x4();
 	intrinsics = Intrinsics();
 	distCoeffs = cv::Mat();
-
 }
-
-ofMatrix4x4 ofxMapamok::makeMatrix(cv::Mat rotation, cv::Mat translation) {
-	cv::Mat rot3x3;
-	if (rotation.rows == 3 && rotation.cols == 3) {
-		rot3x3 = rotation;
-	}
-	else {
-		Rodrigues(rotation, rot3x3);
-	}
-	double* rm = rot3x3.ptr<double>(0);
-	double* tm = translation.ptr<double>(0);
-	return ofMatrix4x4(rm[0], rm[3], rm[6], 0.0f,
-		rm[1], rm[4], rm[7], 0.0f,
-		rm[2], rm[5], rm[8], 0.0f,
-		tm[0], tm[1], tm[2], 1.0f);
-}
\ No newline at end of file
@@ -3,90 +3,58 @@
 #include "ofMain.h"
 #include "ofxOpenCv.h"
 #include "Intrinsics.h"
+#include "ofxMapamokRuntime.h"
+#include "ofxMapamokSolver.h"
 
-#ifndef STRINGIFY
-#define STRINGIFY(x) #x
-#endif
-
-class ofxMapamok {
+class ofxMapamok : public ofxMapamokRuntime {
 public:
 	ofxMapamok();
 
 	void calibrate(ofRectangle vp, vector<cv::Point2f>& imagePoints, vector<cv::Point3f>& objectPoints, int flags, float aov = 80);
+	// queues a calibration on the solver thread, the result is applied by update().
+	// returns the request's number, see getSolutionRequestId()
+	unsigned int calibrateAsync(ofRectangle vp, const vector<cv::Point2f>& imagePoints, const vector<cv::Point3f>& objectPoints, int flags, float aov = 80);
+	// applies the newest finished asynchronous calibration or a reloaded file, call from the render thread
+	void update();
+	bool isCalibrating();
+
+	// quality of the last solved calibration, empty or 0 for loaded calibrations.
+	// residuals and reprojected points are in the order of the calibrated image points
+	float getReprojectionError() const;
+	const vector<float>& getResiduals() const;
+	const vector<cv::Point2f>& getReprojectedPoints() const;
+	// empty unless the last calibration was robust
+	const vector<unsigned char>& getInliers() const;
+	// scores of all distortion models, empty unless autoDistortionModel was used
+	const vector<ofxMapamokSolver::ModelCandidate>& getModelCandidates() const;
+	// the number calibrateAsync() returned for the applied solution, 0 when it was
+	// solved by calibrate() or loaded. numbers only grow
+	unsigned int getSolutionRequestId() const;
 	void setData(cv::Mat1d, cv::Mat rvec, cv::Mat tvec, cv::Size2i imageSize, cv::Mat distortionCoefficients);
-	void setViewport(ofRectangle vp);
-
-	void begin();
-	void end();
-
-	ofVec3f worldToScreen(ofVec3f WorldXYZ, ofRectangle viewport = ofRectangle());
+	void setData(const CalibrationFile::Calibration& calibration);
 
-	void load(string fileName);
+	// calibration.yml through cv::FileStorage, or calibration.bin
+	// false when the file could not be read or has no calibration
+	bool load(string fileName);
 	void save(string fileName, string fileNameSummary = "");
 	void reset();
 
-	bool calibrationReady;
-	float nearDist = 10;
-	float farDist = 2000;
+	// seed each calibration with the previous solution, see ofxMapamokSolver
+	bool incrementalCalibration = true;
+	// reject mismatched points with RANSAC before solving, see ofxMapamokSolver
+	bool robustCalibration = false;
+	float robustInlierThreshold = 4;
+	// pick the distortion model that fits best instead of using the distortion flags
+	bool autoDistortionModel = false;
 
 private:
-	ofMatrix4x4 makeMatrix(cv::Mat rotation, cv::Mat translation);
+	ofxMapamokSolver::Request makeRequest(ofRectangle vp, const vector<cv::Point2f>& imagePoints, const vector<cv::Point3f>& objectPoints, int flags, float aov);
+	void applySolution(const ofxMapamokSolver::Solution& solution);
 
 	cv::Mat rvec, tvec;
-	ofMatrix4x4 modelMatrix;
 	Intrinsics intrinsics;
 	cv::Mat distCoeffs;
 
-	ofRectangle viewport;
-
-	bool useDistortionShader;
-	ofShader distortionShader;
-	ofFbo distortionBuffer;
-
-
-	string distortionVertexShader = STRINGIFY(
-		#version 120\n
-
-		varying vec2 texCoordVarying;
-
-		void main(void)
-		{
-			texCoordVarying = gl_MultiTexCoord0.xy;
-			gl_Position = ftransform();
-		}
-	);
-
-	string distortionFragmentShader = STRINGIFY(
-		#version 120\n
-
-		varying vec2 texCoordVarying;
-
-		uniform sampler2DRect tex0;
-
-		uniform vec3 k; // radial coefficients k1, k2, k3
-		uniform vec3 p; // tangential coefficients p1, p2
-
-		uniform vec2 focalLength;
-		uniform vec2 principalPoint;
-
-
-		void main()
-		{
-			vec2 lensCoordinates = (texCoordVarying - principalPoint) / focalLength;
-
-			float r_2 = dot(lensCoordinates, lensCoordinates);
-			float r_4 = r_2 * r_2;
-			float r_6 = r_2 * r_4;
-			float _2xy = 2.f * lensCoordinates.x * lensCoordinates.y;
-
-			vec2 distorted = (lensCoordinates / (1.f + k.x * r_2 + k.y * r_4 + k.z * r_6)) + vec2(
-				(p.x * _2xy) + p.y * (r_2 + 2.f * lensCoordinates.x * lensCoordinates.x),
-				(p.y * _2xy) + p.x * (r_2 + 2.f * lensCoordinates.y * lensCoordinates.y)
-			);
-
-			vec2 resultUV = distorted * focalLength + principalPoint;
-
-			gl_FragColor = texture2DRect(tex0, resultUV);
-		}
-	);
-};
\ No newline at end of file
+	ofxMapamokSolver solver;
+	ofxMapamokSolver::Solution currentSolution;
+};
@@ -22,13 +22,44 @@ ofxMapamokCalibrator::ofxMapamokCalibrator() {
 
 	enabled = true;
 	selectPoints = true;
+	cullHiddenPoints = true;
+	cullBackFaces = false;
+	lodReferencePoints = true;
+	showResiduals = true;
+	maxResidual = 5;
+}
+
+void ofxMapamokCalibrator::prepare(const ofMesh& mesh, Model& model) {
+	model.mesh = mesh;
+	model.referenceMesh = mergeNearbyVertices(mesh, selectionMergeTolerance);
+	model.referenceIndex.setup(model.referenceMesh.getVertices());
+	model.referencePositions.setup(model.referenceMesh.getVertices());
 }
 
 void ofxMapamokCalibrator::setup(ofMesh mesh) {
-	displayMesh = mesh;
+	Model model;
+	prepare(mesh, model);
+	setup(std::move(model));
+}
+
+// ofMesh can't be moved, but its arrays can be swapped. the non-const getters also
+// mark them as changed, so an ofVboMesh uploads them on the next draw
+static void moveMesh(ofMesh& from, ofMesh& to) {
+	to.clear();
+	to.setMode(from.getMode());
+	to.getVertices().swap(from.getVertices());
+	to.getNormals().swap(from.getNormals());
+	to.getColors().swap(from.getColors());
+	to.getTexCoords().swap(from.getTexCoords());
+	to.getIndices().swap(from.getIndices());
+}
 
-	referenceMesh = ofVboMesh(mesh);
-	referenceMesh = mergeNearbyVertices(referenceMesh, selectionMergeTolerance);
+void ofxMapamokCalibrator::setup(Model&& model) {
+	moveMesh(model.mesh, displayMesh);
+
+	moveMesh(model.referenceMesh, referenceMesh);
+	referenceIndex = std::move(model.referenceIndex);
+	referencePositions = std::move(model.referencePositions);
 
 	referenceMeshPoints.clear();
 	for (std::vector<int>::size_type index = 0; index != referenceMesh.getNumVertices(); index++) {
@@ -38,34 +69,55 @@ void ofxMapamokCalibrator::setup(ofMesh mesh) {
 	placedPoints.clear();
 	objectPoints.clear();
 	pointIndices.clear();
+	placedPointForVertex.assign(referenceMesh.getNumVertices(), -1);
 	dataChanged = true;
+	viewportChanged = true;
 }
 
 void ofxMapamokCalibrator::update() {
+	// pick up a finished background calibration, even while not in setup mode
+	mapamok.update();
+
 	if (!enabled) {
 		return;
 	}
 
 	if (selectPoints) {
+		// when zoomed out, draw and pick only one reference point per few pixels
+		referenceMeshPoints.setLodCellSize(lodReferencePoints ? lodCellSize : 0);
+
 		ofMatrix4x4 modelViewProjectionMatrix = camera.getModelViewProjectionMatrix();
-		if (viewportChanged ||
+		if (viewportChanged || cullHiddenPoints != lastCullHiddenPoints || cullBackFaces != lastCullBackFaces ||
 			!modelViewProjectionMatrix.getRowAsVec4f(0).match(lastModelViewProjectionMatrix.getRowAsVec4f(0)) ||
 			!modelViewProjectionMatrix.getRowAsVec4f(1).match(lastModelViewProjectionMatrix.getRowAsVec4f(1)) ||
 			!modelViewProjectionMatrix.getRowAsVec4f(2).match(lastModelViewProjectionMatrix.getRowAsVec4f(2)) ||
 			!modelViewProjectionMatrix.getRowAsVec4f(3).match(lastModelViewProjectionMatrix.getRowAsVec4f(3))) {
 
 			lastModelViewProjectionMatrix = modelViewProjectionMatrix;
+			lastCullHiddenPoints = cullHiddenPoints;
+			lastCullBackFaces = cullBackFaces;
 			viewportChanged = false;
 
 			ofRectangle windowRect(0, 0, ofGetWidth(), ofGetHeight());
 			ofPoint offset = viewport.getCenter() - windowRect.getCenter();
 			ofRectangle projectRect(0, (windowRect.height - viewport.height) / 2, windowRect.width, viewport.height);
 
-			ofMesh imageMesh = ofVboMesh(referenceMesh);
-			project(imageMesh, camera, projectRect);
-			vector<ofPoint> imageMeshPoints = imageMesh.getVertices();
-			for (std::vector<int>::size_type index = 0; index != imageMeshPoints.size(); index++) {
-				referenceMeshPoints.get(index).position = ofVec2f(imageMeshPoints[index].x, imageMeshPoints[index].y) + offset;
+			// project straight into the points, with the viewport offset folded into the screen rect
+			ofMatrix4x4 projectMatrix = camera.getModelViewProjectionMatrix(projectRect);
+			projectRect.x += offset.x;
+			projectRect.y += offset.y;
+			PositionBuffer& projectedPositions = referenceMeshPoints.getPositions();
+			project(referencePositions, projectMatrix, projectRect, projectedPositions);
+			referenceMeshPoints.updatePositions();
+
+			// only offer vertices that are not hidden behind other geometry
+			if (cullHiddenPoints && referenceMesh.getNumIndices() > 0) {
+				referenceVisibility.setBackFaceCulling(cullBackFaces);
+				referenceVisibility.update(referencePositions, projectedPositions, projectMatrix, camera.getGlobalPosition(), referenceMesh.getIndices(), projectRect, visibleReferencePoints);
+				referenceMeshPoints.setSubset(visibleReferencePoints);
+			}
+			else {
+				referenceMeshPoints.clearSubset();
 			}
 		}
 	}
@@ -98,9 +150,36 @@ void ofxMapamokCalibrator::draw() {
 		}
 
 		placedPoints.draw(ofEventArgs());
+		if (showResiduals) {
+			drawResiduals();
+		}
 	}
 }
 
+void ofxMapamokCalibrator::drawResiduals() {
+	// the solution may still be for an older set of points while the solver catches
+	// up, even one with the same number of points
+	const vector<float>& residuals = mapamok.getResiduals();
+	const vector<cv::Point2f>& reprojectedPoints = mapamok.getReprojectedPoints();
+	if (!mapamok.calibrationReady || placedPoints.pointsChanged ||
+		pointsRequestId == 0 || mapamok.getSolutionRequestId() < pointsRequestId ||
+		residuals.size() != placedPoints.size()) {
+		return;
+	}
+
+	ofPushStyle();
+	ofNoFill();
+	ofSetLineWidth(2);
+	for (unsigned int i = 0; i < residuals.size(); i++) {
+		// green for a perfect fit, red at maxResidual pixels and beyond
+		ofSetColor(ofColor::green.getLerped(ofColor::red, ofClamp(residuals[i] / maxResidual, 0, 1)));
+		ofVec2f placedPoint = placedPoints.getPosition(i);
+		ofCircle(placedPoint, 6);
+		ofLine(placedPoint, toOf(reprojectedPoints[i]));
+	}
+	ofPopStyle();
+}
+
 void ofxMapamokCalibrator::drawHiddenLine(ofMesh mesh) {
 	glPushAttrib(GL_ALL_ATTRIB_BITS);
 
@@ -147,7 +226,7 @@ void ofxMapamokCalibrator::setState(bool select) {
 
 		vector<unsigned int> selectedPoints = referenceMeshPoints.getSelected();
 		for (unsigned int const& selectedPoint : selectedPoints) {
-			if (!referenceMeshPoints.get(selectedPoint).marked) {
+			if (!referenceMeshPoints.isMarked(selectedPoint)) {
 				// new point
 				ofVec2f newPoint;
 				if (mapamok.calibrationReady) {
@@ -163,19 +242,16 @@ void ofxMapamokCalibrator::setState(bool select) {
 
 				unsigned int newPlacedPointIndex = placedPoints.size() - 1;
 				pointIndices.push_back(selectedPoint);
+				placedPointForVertex[selectedPoint] = newPlacedPointIndex;
 
-				referenceMeshPoints.get(selectedPoint).marked = true;
+				referenceMeshPoints.setMarked(selectedPoint, true);
 
 				placedPoints.setSelected(newPlacedPointIndex, true);
 			}
 			else {
 				// point was already placed
-
-				unsigned int previouslyPlacedPointIndex = -1;
-				auto result = find(pointIndices.begin(), pointIndices.end(), selectedPoint);
-				if (result != pointIndices.end()) {
-					previouslyPlacedPointIndex = result - pointIndices.begin();
-
+				int previouslyPlacedPointIndex = placedPointForVertex[selectedPoint];
+				if (previouslyPlacedPointIndex != -1) {
 					placedPoints.setSelected(previouslyPlacedPointIndex, true);
 				}
 			}
@@ -187,44 +263,60 @@ void ofxMapamokCalibrator::removeSelected() {
 	if (selectPoints) {
 		// unmark currently selected reference mesh point and remove corresponding placed point
 		vector<unsigned int> selectedPoints = referenceMeshPoints.getSelected();
-		reverse(selectedPoints.begin(), selectedPoints.end());
 		for (unsigned int const& selectedPoint : selectedPoints) {
-			if (referenceMeshPoints.get(selectedPoint).marked) {
-				referenceMeshPoints.get(selectedPoint).marked = false;
-				auto result = find(pointIndices.begin(), pointIndices.end(), selectedPoint);
-				if (result != pointIndices.end()) {
-					unsigned int placedPointIndex = result - pointIndices.begin();
-					placedPoints.remove(placedPointIndex);
-					pointIndices.erase(pointIndices.begin() + placedPointIndex);
-					objectPoints.erase(objectPoints.begin() + placedPointIndex);
+			if (referenceMeshPoints.isMarked(selectedPoint)) {
+				referenceMeshPoints.setMarked(selectedPoint, false);
+				if (placedPointForVertex[selectedPoint] != -1) {
+					removePlacedPoint(placedPointForVertex[selectedPoint]);
 				}
 			}
 		}
 	}
 	else {
-		// remove currently selected placed point and unmark corresponding reference mesh point
+		// remove currently selected placed point and unmark corresponding reference mesh point,
+		// highest index first so the points moved into removed slots are never still pending
 		vector<unsigned int> selectedPoints = placedPoints.getSelected();
 		reverse(selectedPoints.begin(), selectedPoints.end());
 		for (unsigned int const& selectedPoint : selectedPoints) {
-			referenceMeshPoints.get((pointIndices[selectedPoint])).marked = false;
-			placedPoints.remove(selectedPoint);
-			pointIndices.erase(pointIndices.begin() + selectedPoint);
-			objectPoints.erase(objectPoints.begin() + selectedPoint);
+			referenceMeshPoints.setMarked(pointIndices[selectedPoint], false);
+			removePlacedPoint(selectedPoint);
 		}
 	}
 }
 
+void ofxMapamokCalibrator::removePlacedPoint(unsigned int placedPointIndex) {
+	// same swap with the last entry as SelectablePoints::remove, so all lists keep their order in sync
+	unsigned int last = pointIndices.size() - 1;
+	placedPointForVertex[pointIndices[placedPointIndex]] = -1;
+	if (placedPointIndex != last) {
+		pointIndices[placedPointIndex] = pointIndices[last];
+		objectPoints[placedPointIndex] = objectPoints[last];
+		placedPointForVertex[pointIndices[placedPointIndex]] = placedPointIndex;
+	}
+	pointIndices.pop_back();
+	objectPoints.pop_back();
+	placedPoints.remove(placedPointIndex);
+}
+
 void ofxMapamokCalibrator::calibrate(int flags) {
-	if (placedPoints.pointsChanged || flags != lastFlags) {
+	if (placedPoints.pointsChanged || flags != lastFlags ||
+		mapamok.robustCalibration != lastRobustCalibration ||
+		mapamok.autoDistortionModel != lastAutoDistortionModel) {
 		lastFlags = flags;
+		lastRobustCalibration = mapamok.robustCalibration;
+		lastAutoDistortionModel = mapamok.autoDistortionModel;
 
+		bool newPoints = placedPoints.pointsChanged;
 		placedPoints.pointsChanged = false;
 		vector<cv::Point2f> imagePoints;
 		for (std::vector<int>::size_type i = 0; i != placedPoints.size(); i++) {
-			imagePoints.push_back(toCv(placedPoints.get(i).position));
+			imagePoints.push_back(toCv(placedPoints.getPosition(i)));
 		}
 
-		mapamok.calibrate(viewport, imagePoints, objectPoints, flags, 80);
+		unsigned int requestId = mapamok.calibrateAsync(viewport, imagePoints, objectPoints, flags, 80);
+		if (newPoints) {
+			pointsRequestId = requestId;
+		}
 	}
 }
 
@@ -232,7 +324,7 @@ void ofxMapamokCalibrator::setViewport(ofRectangle vp) {
 	if (vp != viewport) {
 		for (std::vector<int>::size_type i = 0; i != placedPoints.size(); i++) {
 			// scale/translate all placed points from old viewport (viewport) to new viewport (vp)
-			placedPoints.get(i).position = ((placedPoints.get(i).position - viewport.getTopLeft()) / (viewport.getBottomRight() - viewport.getTopLeft())) * (vp.getBottomRight() - vp.getTopLeft()) + vp.getTopLeft();
+			placedPoints.setPosition(i, ((placedPoints.getPosition(i) - viewport.getTopLeft()) / (viewport.getBottomRight() - viewport.getTopLeft())) * (vp.getBottomRight() - vp.getTopLeft()) + vp.getTopLeft());
 		}
 		placedPoints.pointsChanged = true;
 		placedPoints.viewport = vp;
@@ -244,20 +336,43 @@ void ofxMapamokCalibrator::setViewport(ofRectangle vp) {
 	}
 }
 
-void ofxMapamokCalibrator::load(string fileName) {
+bool ofxMapamokCalibrator::load(string fileName) {
 	cv::FileStorage fs(ofToDataPath(fileName, true), cv::FileStorage::READ);
 	if (!fs.isOpened()) {
 		ofLogError() << "could not open pointdata file for reading";
-		return;
+		return false;
 	}
 
 	vector<int> pointIndicesSigned;
+	vector<cv::Point3f> loadedObjectPoints;
 	vector<cv::Point2f> imagePoints;
 
-	fs["objectPoints"] >> objectPoints;
+	fs["objectPoints"] >> loadedObjectPoints;
 	fs["imagePoints"] >> imagePoints;
 	fs["pointIndices"] >> pointIndicesSigned;
-	pointIndices = vector<unsigned int>(pointIndicesSigned.begin(), pointIndicesSigned.end());
+	return setPoints(loadedObjectPoints, imagePoints, vector<unsigned int>(pointIndicesSigned.begin(), pointIndicesSigned.end()));
+}
+
+bool ofxMapamokCalibrator::setPoints(const vector<cv::Point3f>& objectPoints, const vector<cv::Point2f>& imagePoints, const vector<unsigned int>& pointIndices) {
+	if (objectPoints.size() != pointIndices.size() || imagePoints.size() != pointIndices.size()) {
+		ofLogError() << "point data has " << objectPoints.size() << " object points, " << imagePoints.size() << " image points and " << pointIndices.size() << " indices";
+		return false;
+	}
+	// the bitsets behind referenceMeshPoints don't check their bounds
+	unsigned int vertexCount = referenceMesh.getNumVertices();
+	for (auto const& index : pointIndices) {
+		if (index >= vertexCount) {
+			ofLogError() << "point data refers to vertex " << index << " but the model has " << vertexCount << " vertices, load the model it was made for first";
+			return false;
+		}
+	}
+
+	this->objectPoints = objectPoints;
+	this->pointIndices = pointIndices;
+	placedPointForVertex.assign(referenceMesh.getNumVertices(), -1);
+	for (unsigned int i = 0; i < pointIndices.size(); i++) {
+		placedPointForVertex[pointIndices[i]] = i;
+	}
 
 	placedPoints.clear();
 	for (std::vector<int>::size_type i = 0; i != imagePoints.size(); i++) {
@@ -265,10 +380,11 @@ void ofxMapamokCalibrator::load(string fileName) {
 	}
 	referenceMeshPoints.deselectAll(false);
 	for (auto const& index : pointIndices) {
-		referenceMeshPoints.get(index).marked = true;
+		referenceMeshPoints.setMarked(index, true);
 	}
 
 	dataChanged = false;
+	return true;
 }
 
 void ofxMapamokCalibrator::save(string fileName) {
@@ -280,7 +396,7 @@ void ofxMapamokCalibrator::save(string fileName) {
 
 	vector<cv::Point2f> imagePoints;
 	for (std::vector<int>::size_type i = 0; i != placedPoints.size(); i++) {
-		imagePoints.push_back(toCv(placedPoints.get(i).position));
+		imagePoints.push_back(toCv(placedPoints.getPosition(i)));
 	}
 
 	fs << "objectPoints" << objectPoints;
@@ -288,14 +404,141 @@ void ofxMapamokCalibrator::save(string fileName) {
 	fs << "pointIndices" << vector<int>(pointIndices.begin(), pointIndices.end());
 }
 
+bool ofxMapamokCalibrator::loadBinary(string fileName) {
+	CalibrationFile file;
+	if (!file.open(fileName)) {
+		return false;
+	}
+
+	unsigned int n = file.getPointCount();
+	const float* object = file.getObjectPoints();
+	const float* image = file.getImagePoints();
+	vector<cv::Point3f> loadedObjectPoints(n);
+	vector<cv::Point2f> imagePoints(n);
+	for (unsigned int i = 0; i < n; i++) {
+		loadedObjectPoints[i] = cv::Point3f(object[i * 3], object[i * 3 + 1], object[i * 3 + 2]);
+		imagePoints[i] = cv::Point2f(image[i * 2], image[i * 2 + 1]);
+	}
+	const uint32_t* indices = file.getPointIndices();
+	if (!setPoints(loadedObjectPoints, imagePoints, vector<unsigned int>(indices, indices + n))) {
+		return false;
+	}
+
+	if (file.getCalibration().imageWidth != 0 && file.getCalibration().imageHeight != 0) {
+		mapamok.setData(file.getCalibration());
+	}
+	else {
+		mapamok.reset();
+	}
+	return true;
+}
+
+bool ofxMapamokCalibrator::saveBinary(string fileName) {
+	CalibrationFile::Calibration calibration;
+	if (!mapamok.getData(calibration)) {
+		// the point data is still worth keeping
+		memset(&calibration, 0, sizeof(calibration));
+	}
+
+	vector<float> object, image;
+	for (auto const& point : objectPoints) {
+		object.push_back(point.x);
+		object.push_back(point.y);
+		object.push_back(point.z);
+	}
+	for (unsigned int i = 0; i < placedPoints.size(); i++) {
+		ofVec2f position = placedPoints.getPosition(i);
+		image.push_back(position.x);
+		image.push_back(position.y);
+	}
+	return CalibrationFile::save(fileName, calibration, object, image, vector<uint32_t>(pointIndices.begin(), pointIndices.end()));
+}
+
+bool ofxMapamokCalibrator::isBinaryCurrent(string folder) {
+	folder = ofFilePath::addTrailingSlash(folder);
+	long long binaryTime = FileWatcher::getModificationTime(folder + "calibration.bin");
+	if (binaryTime == 0) {
+		return false;
+	}
+	// a yml file that does not exist can't be newer
+	return binaryTime > FileWatcher::getModificationTime(folder + "calibration.yml") &&
+		binaryTime > FileWatcher::getModificationTime(folder + "pointdata.yml");
+}
+
+bool ofxMapamokCalibrator::convertToBinary(string folder) {
+	folder = ofFilePath::addTrailingSlash(folder);
+	cv::FileStorage calibrationFs(ofToDataPath(folder + "calibration.yml", true), cv::FileStorage::READ);
+	cv::FileStorage pointDataFs(ofToDataPath(folder + "pointdata.yml", true), cv::FileStorage::READ);
+	if (!calibrationFs.isOpened() || !pointDataFs.isOpened()) {
+		ofLogError() << "could not open the calibration files in " << folder;
+		return false;
+	}
+
+	CalibrationFile::Calibration calibration;
+	memset(&calibration, 0, sizeof(calibration));
+	cv::Mat cameraMatrix, rotation, translation, distortionCoefficients;
+	calibrationFs["cameraMatrix"] >> cameraMatrix;
+	calibrationFs["imageSize"][0] >> calibration.imageWidth;
+	calibrationFs["imageSize"][1] >> calibration.imageHeight;
+	calibrationFs["rotationVector"] >> rotation;
+	calibrationFs["translationVector"] >> translation;
+	calibrationFs["distCoeffs"] >> distortionCoefficients;
+	if (cameraMatrix.total() != 9 || rotation.total() != 3 || translation.total() != 3) {
+		ofLogError() << "incomplete calibration in " << folder;
+		return false;
+	}
+	for (int i = 0; i < 9; i++) {
+		calibration.cameraMatrix[i] = cameraMatrix.at<double>(i / 3, i % 3);
+	}
+	for (int i = 0; i < 3; i++) {
+		calibration.rotationVector[i] = rotation.at<double>(i);
+		calibration.translationVector[i] = translation.at<double>(i);
+	}
+	for (int i = 0; i < std::min<int>(distortionCoefficients.total(), 5); i++) {
+		calibration.distortionCoefficients[i] = distortionCoefficients.at<double>(i);
+	}
+
+	vector<cv::Point3f> objectPoints;
+	vector<cv::Point2f> imagePoints;
+	vector<int> pointIndices;
+	pointDataFs["objectPoints"] >> objectPoints;
+	pointDataFs["imagePoints"] >> imagePoints;
+	pointDataFs["pointIndices"] >> pointIndices;
+
+	vector<float> object, image;
+	for (auto const& point : objectPoints) {
+		object.push_back(point.x);
+		object.push_back(point.y);
+		object.push_back(point.z);
+	}
+	for (auto const& point : imagePoints) {
+		image.push_back(point.x);
+		image.push_back(point.y);
+	}
+	return CalibrationFile::save(folder + "calibration.bin", calibration, object, image, vector<uint32_t>(pointIndices.begin(), pointIndices.end()));
+}
+
 void ofxMapamokCalibrator::reset() {
 	referenceMeshPoints.deselectAll(false);
 	placedPoints.clear();
 	objectPoints.clear();
 	pointIndices.clear();
+	placedPointForVertex.assign(referenceMesh.getNumVertices(), -1);
 	dataChanged = true;
 }
 
+ofVboMesh& ofxMapamokCalibrator::getMesh() {
+	return displayMesh;
+}
+
+const ofMesh& ofxMapamokCalibrator::getReferenceMesh() const {
+	return referenceMesh;
+}
+
+const VertexIndex& ofxMapamokCalibrator::getReferenceIndex() const {
+	return referenceIndex;
+}
+
 cv::Point2f ofxMapamokCalibrator::toCv(ofVec2f vec) {
 	return cv::Point2f(vec.x, vec.y);
 }
@@ -13,7 +13,19 @@ class ofxMapamokCalibrator
 public:
 	ofxMapamokCalibrator();
 
+	// the merged reference mesh and its index, everything setup() computes from a
+	// model. prepare() makes no GL calls, so it can run on a loader thread while
+	// the previous model is still in use, and setup(model) only moves it in.
+	struct Model {
+		ofMesh mesh;
+		ofMesh referenceMesh;
+		VertexIndex referenceIndex;
+		PositionBuffer referencePositions;
+	};
+	static void prepare(const ofMesh& mesh, Model& model);
+
 	void setup(ofMesh mesh);
+	void setup(Model&& model);
 	void update();
 	void draw();
 
@@ -23,12 +35,34 @@ public:
 	void calibrate(int flags);
 	void setViewport(ofRectangle vp);
 
-	void load(string fileName);
+	// false when the file can't be read or its points don't fit the current model
+	bool load(string fileName);
 	void save(string fileName);
+	// the calibration and the point data in one CalibrationFile, much faster to load than yml
+	bool loadBinary(string fileName);
+	bool saveBinary(string fileName);
+	// writes folder/calibration.bin from the calibration.yml and pointdata.yml in folder
+	static bool convertToBinary(string folder);
+	// true when folder/calibration.bin is newer than the yml files it is made from, so
+	// it can be loaded instead of them. the yml files are the ones people edit
+	static bool isBinaryCurrent(string folder);
 	void reset();
 
+	// the model passed to setup(), for drawing it without keeping another copy
+	ofVboMesh& getMesh();
+	const ofMesh& getReferenceMesh() const;
+	const VertexIndex& getReferenceIndex() const;
+
 	bool enabled;
 	bool selectPoints;
+	bool cullHiddenPoints;
+	// also hide points on faces turned away from the camera, off by default since
+	// scans are often seen from inside or have inconsistent winding
+	bool cullBackFaces;
+	bool lodReferencePoints;
+	bool showResiduals;
+	// residual in pixels that is drawn fully red
+	float maxResidual;
 
 	ofEasyCam camera;
 	ofxMapamok mapamok;
@@ -36,6 +70,10 @@ public:
 
 private:
 	void drawHiddenLine(ofMesh mesh);
+	void drawResiduals();
+	void removePlacedPoint(unsigned int placedPointIndex);
+	// false, leaving the current points in place, when they don't belong to the current model
+	bool setPoints(const vector<cv::Point3f>& objectPoints, const vector<cv::Point2f>& imagePoints, const vector<unsigned int>& pointIndices);
 	cv::Point2f toCv(ofVec2f vec);
 	cv::Point3f toCv(ofVec3f vec);
 	ofVec2f toOf(cv::Point2f point);
@@ -43,6 +81,12 @@ private:
 
 	ofVboMesh displayMesh;
 	ofVboMesh referenceMesh;
+	VertexIndex referenceIndex;
+	PositionBuffer referencePositions;
+	VertexVisibility referenceVisibility;
+	vector<unsigned int> visibleReferencePoints;
+	bool lastCullHiddenPoints = false;
+	bool lastCullBackFaces = false;
 	SelectablePoints referenceMeshPoints;
 
 	bool viewportChanged;
@@ -50,10 +94,18 @@ private:
 	DraggablePoints placedPoints;
 	vector<unsigned int> pointIndices;
 	vector<cv::Point3f> objectPoints;
+	// reverse of pointIndices, -1 for reference vertices that have no placed point
+	vector<int> placedPointForVertex;
 
-	const float selectionMergeTolerance = .01;
+	static constexpr float selectionMergeTolerance = .01;
+	const float lodCellSize = 8;
 
 	bool dataChanged = false;
+	// the first calibration request made for the current placed points, solutions
+	// of older requests belong to other points and have no residuals to show
+	unsigned int pointsRequestId = 0;
 	int lastFlags;
+	bool lastRobustCalibration = false;
+	bool lastAutoDistortionModel = false;
 	ofMatrix4x4 lastModelViewProjectionMatrix;
 };
@@ -0,0 +1,549 @@
+#include "ofxMapamokSolver.h"
+
+#include <cfloat>
+#include <random>
+
+ofxMapamokSolver::ofxMapamokSolver()
+:stopping(false)
+,hasRequest(false)
+,hasSolution(false)
+,solving(false)
+,generation(0)
+,requestCount(0)
+,pendingRequestId(0) {
+}
+
+ofxMapamokSolver::~ofxMapamokSolver() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	condition.notify_all();
+	if (thread.joinable()) {
+		thread.join();
+	}
+}
+
+ofxMapamokSolver::Solution ofxMapamokSolver::Solution::clone() const {
+	Solution copy = *this;
+	copy.cameraMatrix = cameraMatrix.clone();
+	copy.rvec = rvec.clone();
+	copy.tvec = tvec.clone();
+	copy.distortionCoefficients = distortionCoefficients.clone();
+	return copy;
+}
+
+bool ofxMapamokSolver::isPoseOnly(int flags) {
+	int fixedIntrinsics =
+		CV_CALIB_FIX_FOCAL_LENGTH |
+		CV_CALIB_FIX_PRINCIPAL_POINT |
+		CV_CALIB_FIX_K1 |
+		CV_CALIB_FIX_K2 |
+		CV_CALIB_FIX_K3 |
+		CV_CALIB_ZERO_TANGENT_DIST;
+	if (flags & CV_CALIB_RATIONAL_MODEL) {
+		fixedIntrinsics |= CV_CALIB_FIX_K4 | CV_CALIB_FIX_K5 | CV_CALIB_FIX_K6;
+	}
+	return (flags & fixedIntrinsics) == fixedIntrinsics;
+}
+
+void ofxMapamokSolver::computeResiduals(const Request& request, Solution& solution) {
+	unsigned int n = request.imagePoints.size();
+	projectPoints(request.objectPoints, solution.rvec, solution.tvec, solution.cameraMatrix, solution.distortionCoefficients, solution.reprojectedPoints);
+
+	cv::Point2f offset(request.viewport.x, request.viewport.y);
+	bool useMask = solution.inliers.size() == n;
+	solution.residuals.resize(n);
+	double sumSquared = 0;
+	unsigned int counted = 0;
+	for (unsigned int i = 0; i < n; i++) {
+		cv::Point2f& reprojected = solution.reprojectedPoints[i];
+		reprojected = reprojected + offset;
+		cv::Point2f difference = reprojected - request.imagePoints[i];
+		float squared = difference.dot(difference);
+		solution.residuals[i] = sqrt(squared);
+		if (!useMask || solution.inliers[i]) {
+			sumSquared += squared;
+			counted++;
+		}
+	}
+	solution.rms = counted > 0 ? sqrt(sumSquared / counted) : 0;
+}
+
+// the camera matrix a solve without a warm start begins with
+static cv::Mat1d getInitialCameraMatrix(const ofxMapamokSolver::Request& request) {
+	cv::Size2i imageSize(request.viewport.width, request.viewport.height);
+	float f = imageSize.width * ofDegToRad(request.aov); // this might be wrong, but it's optimized out
+	cv::Point2f c = cv::Point2f(imageSize) * (1. / 2);
+	return (cv::Mat1d(3, 3) <<
+		f, 0, c.x,
+		0, f, c.y,
+		0, 0, 1);
+}
+
+ofxMapamokSolver::Solution ofxMapamokSolver::solve(const Request& request) {
+	Solution solution;
+	int n = request.imagePoints.size();
+	if (n < minPoints) {
+		return solution;
+	}
+	if (request.autoModel) {
+		return solveAutoModel(request);
+	}
+	if (request.robust && n > minPoints) {
+		return solveRobust(request);
+	}
+	uint64_t startTime = ofGetElapsedTimeMicros();
+
+	const ofRectangle& vp = request.viewport;
+	vector<cv::Mat> rvecs, tvecs;
+	vector<vector<cv::Point3f> > objectPointsCv;
+	vector<vector<cv::Point2f> > imagePointsCv;
+	cv::Point2f offset(vp.x, vp.y);
+	if (offset == cv::Point2f(0, 0)) {
+		imagePointsCv.push_back(request.imagePoints);
+	} else {
+		vector<cv::Point2f> offsetPoints;
+		for (auto const& point : request.imagePoints) {
+			offsetPoints.push_back(point - offset);
+		}
+		imagePointsCv.push_back(offsetPoints);
+	}
+	objectPointsCv.push_back(request.objectPoints);
+
+	cv::Size2i imageSize(vp.width, vp.height);
+	solution.imageSize = imageSize;
+	solution.flags = request.flags;
+
+	// the previous intrinsics are a better guess than the angle of view whenever the
+	// image size is the same, even when other parameters are fixed now. its distortion
+	// is only reused for the same distortion model, a coefficient that is fixed now
+	// must stay at 0 instead of keeping the previous value
+	const Solution& warmStart = request.warmStart;
+	if (warmStart.ready && warmStart.imageSize == imageSize) {
+		bool sameModel = (warmStart.flags & modelFlags) == (request.flags & modelFlags);
+		solution.warmStarted = true;
+		solution.cameraMatrix = warmStart.cameraMatrix.clone();
+		if (sameModel) {
+			solution.distortionCoefficients = warmStart.distortionCoefficients.clone();
+		}
+		if (sameModel && isPoseOnly(request.flags)) {
+			solution.poseOnly = true;
+			solution.rvec = warmStart.rvec.clone();
+			solution.tvec = warmStart.tvec.clone();
+			solvePnP(request.objectPoints, imagePointsCv[0], solution.cameraMatrix, solution.distortionCoefficients, solution.rvec, solution.tvec, true, CV_ITERATIVE);
+			solution.ready = true;
+			computeResiduals(request, solution);
+			solution.solveTime = (ofGetElapsedTimeMicros() - startTime) / 1000.;
+			return solution;
+		}
+	} else {
+		solution.cameraMatrix = getInitialCameraMatrix(request);
+	}
+
+	calibrateCamera(objectPointsCv, imagePointsCv, imageSize, solution.cameraMatrix, solution.distortionCoefficients, rvecs, tvecs, request.flags);
+
+	solution.ready = true;
+	solution.rvec = rvecs[0];
+	solution.tvec = tvecs[0];
+	computeResiduals(request, solution);
+	solution.solveTime = (ofGetElapsedTimeMicros() - startTime) / 1000.;
+	return solution;
+}
+
+const vector<ofxMapamokSolver::ModelPreset>& ofxMapamokSolver::getModelPresets() {
+	static vector<ModelPreset> presets = {
+		{ "none", CV_CALIB_FIX_K1 | CV_CALIB_FIX_K2 | CV_CALIB_FIX_K3 | CV_CALIB_ZERO_TANGENT_DIST },
+		{ "k1", CV_CALIB_FIX_K2 | CV_CALIB_FIX_K3 | CV_CALIB_ZERO_TANGENT_DIST },
+		{ "k1 k2", CV_CALIB_FIX_K3 | CV_CALIB_ZERO_TANGENT_DIST },
+		{ "k1 k2 k3", CV_CALIB_ZERO_TANGENT_DIST },
+		{ "k1 p1 p2", CV_CALIB_FIX_K2 | CV_CALIB_FIX_K3 },
+		{ "k1 k2 p1 p2", CV_CALIB_FIX_K3 }
+	};
+	return presets;
+}
+
+int ofxMapamokSolver::countParameters(int flags) {
+	int parameters = 6; // pose
+	if (!(flags & CV_CALIB_FIX_FOCAL_LENGTH)) {
+		parameters += (flags & CV_CALIB_FIX_ASPECT_RATIO) ? 1 : 2;
+	}
+	if (!(flags & CV_CALIB_FIX_PRINCIPAL_POINT)) {
+		parameters += 2;
+	}
+	parameters += !(flags & CV_CALIB_FIX_K1) + !(flags & CV_CALIB_FIX_K2) + !(flags & CV_CALIB_FIX_K3);
+	if (!(flags & CV_CALIB_ZERO_TANGENT_DIST)) {
+		parameters += 2;
+	}
+	return parameters;
+}
+
+ofxMapamokSolver::Solution ofxMapamokSolver::solveAutoModel(const Request& request) {
+	uint64_t startTime = ofGetElapsedTimeMicros();
+	const vector<ModelPreset>& presets = getModelPresets();
+	unsigned int n = request.imagePoints.size();
+
+	// point i is held out in fold i % folds, as long as the rest can still be solved
+	unsigned int folds = std::min(request.folds, n);
+	bool crossValidate = folds > 1 && n - (n + folds - 1) / folds >= minPoints;
+	if (!crossValidate) {
+		folds = 0;
+	}
+
+	// one task per preset and fold, plus the solve on all points for each preset
+	unsigned int tasksPerPreset = folds + 1;
+	vector<Solution> fullSolutions(presets.size());
+	vector<vector<float> > heldOutResiduals(presets.size() * folds);
+	parallelFor(0, presets.size() * tasksPerPreset, [&](size_t begin, size_t end) {
+		for (size_t task = begin; task < end; task++) {
+			unsigned int preset = task / tasksPerPreset, fold = task % tasksPerPreset;
+			Request presetRequest = request;
+			presetRequest.autoModel = false;
+			presetRequest.robust = false;
+			presetRequest.flags = (request.flags & ~distortionFlags) | presets[preset].flags;
+			// every preset and fold starts cold. the previous solution was fitted on every
+			// point, so it would leak the held out points and favor the previous winner
+			presetRequest.warmStart = Solution();
+			try {
+				if (fold == folds) {
+					fullSolutions[preset] = solve(presetRequest);
+					continue;
+				}
+				Request heldOutRequest = presetRequest;
+				presetRequest.imagePoints.clear();
+				presetRequest.objectPoints.clear();
+				heldOutRequest.imagePoints.clear();
+				heldOutRequest.objectPoints.clear();
+				for (unsigned int i = 0; i < n; i++) {
+					Request& target = (i % folds == fold) ? heldOutRequest : presetRequest;
+					target.imagePoints.push_back(request.imagePoints[i]);
+					target.objectPoints.push_back(request.objectPoints[i]);
+				}
+				Solution trained = solve(presetRequest);
+				if (trained.ready) {
+					computeResiduals(heldOutRequest, trained);
+					heldOutResiduals[preset * folds + fold] = trained.residuals;
+				}
+			} catch (cv::Exception&) {
+				// leaves the preset or fold without a result
+			}
+		}
+	}, 1);
+
+	vector<ModelCandidate> candidates(presets.size());
+	int best = -1;
+	for (unsigned int preset = 0; preset < presets.size(); preset++) {
+		ModelCandidate& candidate = candidates[preset];
+		candidate.name = presets[preset].name;
+		candidate.flags = presets[preset].flags;
+		candidate.crossValidated = crossValidate;
+		candidate.ready = fullSolutions[preset].ready;
+		if (crossValidate) {
+			double sumSquared = 0;
+			unsigned int count = 0;
+			for (unsigned int fold = 0; fold < folds; fold++) {
+				const vector<float>& residuals = heldOutResiduals[preset * folds + fold];
+				if (residuals.empty()) {
+					candidate.ready = false;
+				}
+				for (unsigned int i = 0; i < residuals.size(); i++) {
+					sumSquared += residuals[i] * residuals[i];
+					count++;
+				}
+			}
+			candidate.score = count > 0 ? sqrt(sumSquared / count) : 0;
+		} else if (candidate.ready) {
+			// BIC for gaussian pixel noise, with two observations per point
+			double observations = 2. * n;
+			double residualSumSquared = n * fullSolutions[preset].rms * fullSolutions[preset].rms;
+			candidate.score = observations * log(std::max(residualSumSquared / observations, 1e-12)) +
+				countParameters(fullSolutions[preset].flags) * log(observations);
+		}
+		if (candidate.ready && (best == -1 || candidate.score < candidates[best].score)) {
+			best = preset;
+		}
+	}
+
+	// a robust solve is only run for the winning model, scoring every fold with RANSAC would be too slow
+	Solution solution;
+	if (best != -1) {
+		if (request.robust) {
+			Request robustRequest = request;
+			robustRequest.autoModel = false;
+			robustRequest.flags = (request.flags & ~distortionFlags) | presets[best].flags;
+			solution = solve(robustRequest);
+		} else {
+			solution = fullSolutions[best];
+		}
+	}
+	solution.modelCandidates = candidates;
+	solution.solveTime = (ofGetElapsedTimeMicros() - startTime) / 1000.;
+	return solution;
+}
+
+// the minimal sample of a RANSAC iteration only depends on the seed and the iteration
+static void getSample(unsigned int seed, unsigned int iteration, unsigned int n, vector<unsigned int>& indices) {
+	std::seed_seq sequence = { seed, iteration };
+	std::mt19937 random(sequence);
+	std::uniform_int_distribution<unsigned int> pick(0, n - 1);
+	indices.clear();
+	while (indices.size() < ofxMapamokSolver::minPoints) {
+		unsigned int index = pick(random);
+		if (find(indices.begin(), indices.end(), index) == indices.end()) {
+			indices.push_back(index);
+		}
+	}
+}
+
+// the 3x4 projection matrix that maps objectPoints to imagePoints by the direct linear
+// transform. both are moved to their centroid and scaled to unit distance first, so
+// the system is well conditioned
+static cv::Mat1d solveProjection(const vector<cv::Point3f>& objectPoints, const vector<cv::Point2f>& imagePoints) {
+	unsigned int n = objectPoints.size();
+	cv::Point3d objectCenter;
+	cv::Point2d imageCenter;
+	for (unsigned int i = 0; i < n; i++) {
+		objectCenter += cv::Point3d(objectPoints[i]) * (1. / n);
+		imageCenter += cv::Point2d(imagePoints[i]) * (1. / n);
+	}
+	double objectDistance = 0, imageDistance = 0;
+	for (unsigned int i = 0; i < n; i++) {
+		objectDistance += cv::norm(cv::Point3d(objectPoints[i]) - objectCenter) / n;
+		imageDistance += cv::norm(cv::Point2d(imagePoints[i]) - imageCenter) / n;
+	}
+	double objectScale = objectDistance > 0 ? sqrt(3.) / objectDistance : 1;
+	double imageScale = imageDistance > 0 ? sqrt(2.) / imageDistance : 1;
+
+	cv::Mat1d system = cv::Mat1d::zeros(2 * n, 12);
+	for (unsigned int i = 0; i < n; i++) {
+		cv::Point3d object = (cv::Point3d(objectPoints[i]) - objectCenter) * objectScale;
+		cv::Point2d image = (cv::Point2d(imagePoints[i]) - imageCenter) * imageScale;
+		double X[4] = { object.x, object.y, object.z, 1 };
+		double* u = system[2 * i];
+		double* v = system[2 * i + 1];
+		for (int j = 0; j < 4; j++) {
+			u[j] = X[j];
+			u[8 + j] = -image.x * X[j];
+			v[4 + j] = X[j];
+			v[8 + j] = -image.y * X[j];
+		}
+	}
+	cv::Mat1d normalized;
+	cv::SVD::solveZ(system, normalized);
+
+	cv::Mat1d objectTransform = (cv::Mat1d(4, 4) <<
+		objectScale, 0, 0, -objectScale * objectCenter.x,
+		0, objectScale, 0, -objectScale * objectCenter.y,
+		0, 0, objectScale, -objectScale * objectCenter.z,
+		0, 0, 0, 1);
+	cv::Mat1d imageTransformInverse = (cv::Mat1d(3, 3) <<
+		1 / imageScale, 0, imageCenter.x,
+		0, 1 / imageScale, imageCenter.y,
+		0, 0, 1);
+	return imageTransformInverse * normalized.reshape(1, 3) * objectTransform;
+}
+
+// the residual of every point of the request under a hypothesis solved from the
+// points at indices. six points are too few to also solve the distortion or the
+// intrinsics next to the pose, that would fit nearly any sample. so the pose is
+// solved with the previous intrinsics when there are some, and a linear projection
+// without distortion otherwise. false for a degenerate sample
+static bool solveHypothesis(const ofxMapamokSolver::Request& request, const cv::Mat1d& cameraMatrix, const vector<unsigned int>& indices, vector<float>& residuals) {
+	cv::Point2f offset(request.viewport.x, request.viewport.y);
+	vector<cv::Point3f> objectPoints(indices.size());
+	vector<cv::Point2f> imagePoints(indices.size());
+	for (unsigned int i = 0; i < indices.size(); i++) {
+		objectPoints[i] = request.objectPoints[indices[i]];
+		imagePoints[i] = request.imagePoints[indices[i]] - offset;
+	}
+
+	if (!cameraMatrix.empty()) {
+		ofxMapamokSolver::Solution hypothesis;
+		hypothesis.cameraMatrix = cameraMatrix;
+		try {
+			if (!solvePnP(objectPoints, imagePoints, cameraMatrix, cv::Mat(), hypothesis.rvec, hypothesis.tvec, false, CV_ITERATIVE)) {
+				return false;
+			}
+		} catch (cv::Exception&) {
+			// degenerate sample
+			return false;
+		}
+		ofxMapamokSolver::computeResiduals(request, hypothesis);
+		residuals = hypothesis.residuals;
+		return true;
+	}
+
+	cv::Mat1d projection = solveProjection(objectPoints, imagePoints);
+	unsigned int n = request.imagePoints.size();
+	residuals.resize(n);
+	for (unsigned int i = 0; i < n; i++) {
+		const cv::Point3f& object = request.objectPoints[i];
+		double projected[3];
+		for (int row = 0; row < 3; row++) {
+			const double* p = projection[row];
+			projected[row] = p[0] * object.x + p[1] * object.y + p[2] * object.z + p[3];
+		}
+		if (fabs(projected[2]) < 1e-12) {
+			residuals[i] = FLT_MAX;
+			continue;
+		}
+		cv::Point2f image(projected[0] / projected[2], projected[1] / projected[2]);
+		residuals[i] = cv::norm(image + offset - request.imagePoints[i]);
+	}
+	return true;
+}
+
+ofxMapamokSolver::Solution ofxMapamokSolver::solveRobust(const Request& request) {
+	uint64_t startTime = ofGetElapsedTimeMicros();
+	unsigned int n = request.imagePoints.size();
+
+	// hypotheses only reuse the intrinsics of the previous solution, not its pose
+	const Solution& warmStart = request.warmStart;
+	cv::Size2i imageSize(request.viewport.width, request.viewport.height);
+	cv::Mat1d cameraMatrix;
+	if (warmStart.ready && warmStart.imageSize == imageSize) {
+		cameraMatrix = warmStart.cameraMatrix;
+	}
+
+	// score every hypothesis separately, so picking the best one afterwards is deterministic
+	vector<unsigned int> inlierCounts(request.ransacIterations, 0);
+	vector<float> inlierErrors(request.ransacIterations, 0);
+	parallelFor(0, request.ransacIterations, [&](size_t begin, size_t end) {
+		vector<unsigned int> indices;
+		vector<float> residuals;
+		for (size_t iteration = begin; iteration < end; iteration++) {
+			getSample(request.seed, iteration, n, indices);
+			if (!solveHypothesis(request, cameraMatrix, indices, residuals)) {
+				continue;
+			}
+			for (unsigned int i = 0; i < n; i++) {
+				if (residuals[i] < request.inlierThreshold) {
+					inlierCounts[iteration]++;
+					inlierErrors[iteration] += residuals[i];
+				}
+			}
+		}
+	}, 1);
+
+	unsigned int best = 0;
+	for (unsigned int iteration = 1; iteration < request.ransacIterations; iteration++) {
+		if (inlierCounts[iteration] > inlierCounts[best] ||
+			(inlierCounts[iteration] == inlierCounts[best] && inlierErrors[iteration] < inlierErrors[best])) {
+			best = iteration;
+		}
+	}
+
+	// only the inliers of the best hypothesis are solved with the requested flags. it
+	// has to be solved again since only its score was kept
+	Request refineRequest = request;
+	refineRequest.robust = false;
+	Solution solution;
+	if (request.ransacIterations > 0 && inlierCounts[best] >= minPoints) {
+		vector<unsigned int> indices;
+		vector<float> residuals;
+		getSample(request.seed, best, n, indices);
+		solveHypothesis(request, cameraMatrix, indices, residuals);
+
+		solution.inliers.resize(n);
+		refineRequest.imagePoints.clear();
+		refineRequest.objectPoints.clear();
+		for (unsigned int i = 0; i < n; i++) {
+			solution.inliers[i] = residuals[i] < request.inlierThreshold;
+			if (solution.inliers[i]) {
+				refineRequest.imagePoints.push_back(request.imagePoints[i]);
+				refineRequest.objectPoints.push_back(request.objectPoints[i]);
+			}
+		}
+	} else {
+		// no consensus, fall back to using every point
+		solution.inliers.assign(n, 1);
+	}
+
+	vector<unsigned char> inliers = solution.inliers;
+	solution = solve(refineRequest);
+	if (solution.ready) {
+		solution.inliers = inliers;
+		computeResiduals(request, solution);
+	}
+	solution.solveTime = (ofGetElapsedTimeMicros() - startTime) / 1000.;
+	return solution;
+}
+
+unsigned int ofxMapamokSolver::request(const Request& request) {
+	unsigned int requestId;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		pendingRequest = request;
+		pendingRequestId = requestId = ++requestCount;
+		hasRequest = true;
+		if (!thread.joinable()) {
+			thread = std::thread(&ofxMapamokSolver::work, this);
+		}
+	}
+	condition.notify_all();
+	return requestId;
+}
+
+bool ofxMapamokSolver::getSolution(Solution& solution) {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!hasSolution) {
+		return false;
+	}
+	solution = newestSolution;
+	newestSolution = Solution();
+	hasSolution = false;
+	return true;
+}
+
+void ofxMapamokSolver::cancel() {
+	std::lock_guard<std::mutex> lock(mutex);
+	generation++;
+	hasRequest = false;
+	hasSolution = false;
+	newestSolution = Solution();
+}
+
+bool ofxMapamokSolver::isBusy() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return hasRequest || solving;
+}
+
+void ofxMapamokSolver::work() {
+	// like the thread itself, the pool only exists once something was requested
+	ThreadPool pool;
+	ThreadPool::setCurrent(&pool);
+	while (true) {
+		Request request;
+		unsigned int requestGeneration, requestId;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			condition.wait(lock, [this]() { return stopping || hasRequest; });
+			if (stopping) {
+				return;
+			}
+			request = std::move(pendingRequest);
+			hasRequest = false;
+			solving = true;
+			requestGeneration = generation;
+			requestId = pendingRequestId;
+		}
+
+		Solution solution;
+		try {
+			solution = solve(request);
+		} catch (cv::Exception& e) {
+			ofLogWarning() << "calibration failed: " << e.what();
+		}
+		solution.requestId = requestId;
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			solving = false;
+			// a solution for a cancelled request is dropped, a newer one simply replaces it
+			if (requestGeneration == generation) {
+				newestSolution = solution;
+				hasSolution = true;
+			}
+		}
+	}
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include "ofMain.h"
+#include "ofxOpenCv.h"
+#include "ThreadPool.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+/*
+ ofxMapamokSolver runs the camera calibration on a background thread, so the
+ render loop never waits for cv::calibrateCamera.
+
+ request() hands over a copy of the correspondences and returns immediately.
+ Requests that arrive while a solve is running replace each other, only the
+ newest one is solved next. getSolution() returns the newest finished solution
+ once, and is meant to be polled from the render thread. Requests are numbered
+ from 1, and every solution carries the number of the request it answers, so
+ the caller can tell whether it still belongs to the points on screen.
+
+ A request can carry the previous solution as a warm start. When it was solved
+ for the same image size, its camera matrix seeds calibrateCamera, and so do its
+ distortion coefficients when the distortion model is the same. When the flags
+ also fix every intrinsic parameter only the pose is refined with solvePnP,
+ starting from the previous pose.
+
+ A robust request runs RANSAC first: hypotheses are solved from random minimal
+ samples in parallel, the one that explains most points within the inlier
+ threshold wins, and the final solve only uses its inliers. Hypotheses ignore
+ distortion and the requested flags: they are poses for the intrinsics of the
+ warm start when there is one, and linear projections otherwise. Only the final
+ solve uses the flags and the warm start. Every iteration has
+ its own seeded generator, so the result does not depend on thread timing.
+ The solver thread runs the hypotheses and the model selection below on its
+ own ThreadPool, so they never compete with the render thread's parallelFor().
+ Both are started by the first request(), an app that never calibrates pays
+ for neither.
+
+ With autoModel the distortion flags of the request are ignored. Every preset
+ in getModelPresets() is solved in parallel and scored by its k-fold held-out
+ reprojection error, or by BIC when there are too few points to hold any out.
+ The preset with the lowest score is used, and all scores are reported.
+*/
+
+class ofxMapamokSolver {
+public:
+	struct ModelPreset {
+		string name;
+		int flags; // only the distortion flags
+	};
+
+	struct ModelCandidate {
+		string name;
+		int flags;
+		bool ready = false;
+		bool crossValidated = false;
+		// held-out rms in pixels when cross validated, BIC otherwise, lower is better
+		double score = 0;
+	};
+
+	struct Solution {
+		bool ready = false;
+		cv::Mat1d cameraMatrix;
+		cv::Mat rvec, tvec;
+		cv::Size2i imageSize;
+		cv::Mat distortionCoefficients;
+
+		int flags = 0;
+		bool warmStarted = false;
+		bool poseOnly = false;
+		float solveTime = 0; // in milliseconds
+		// the number request() returned, 0 when solved on the calling thread
+		unsigned int requestId = 0;
+
+		// reprojection of every object point with the solution, in viewport coordinates,
+		// and its distance to the image point in pixels
+		vector<cv::Point2f> reprojectedPoints;
+		vector<float> residuals;
+		float rms = 0;
+
+		// one entry per image point, 0 for points rejected by a robust solve
+		vector<unsigned char> inliers;
+
+		// every distortion model that was tried by an automatic model selection
+		vector<ModelCandidate> modelCandidates;
+
+		// deep copy, so another thread can refine it without touching the original
+		Solution clone() const;
+	};
+
+	struct Request {
+		ofRectangle viewport;
+		vector<cv::Point2f> imagePoints;
+		vector<cv::Point3f> objectPoints;
+		int flags = 0;
+		float aov = 80;
+		Solution warmStart;
+
+		bool robust = false;
+		float inlierThreshold = 4; // in pixels
+		unsigned int ransacIterations = 256;
+		unsigned int seed = 0;
+
+		bool autoModel = false;
+		unsigned int folds = 5;
+	};
+
+	static const int minPoints = 6;
+
+	ofxMapamokSolver();
+	~ofxMapamokSolver();
+
+	// solves on the calling thread
+	static Solution solve(const Request& request);
+	// true when flags leave only the pose free
+	static bool isPoseOnly(int flags);
+	static const vector<ModelPreset>& getModelPresets();
+	static const int distortionFlags = CV_CALIB_FIX_K1 | CV_CALIB_FIX_K2 | CV_CALIB_FIX_K3 | CV_CALIB_ZERO_TANGENT_DIST;
+	// the flags that change which distortion model is solved, unlike the ones that only fix the camera matrix
+	static const int modelFlags = distortionFlags | CV_CALIB_RATIONAL_MODEL;
+	// fills in reprojectedPoints, residuals and rms of a ready solution, the rms
+	// only counts inliers when the solution has an inlier mask
+	static void computeResiduals(const Request& request, Solution& solution);
+
+	// returns the number the solution to this request will carry
+	unsigned int request(const Request& request);
+	bool getSolution(Solution& solution);
+	// drops the pending request and any solution that is still being computed
+	void cancel();
+	bool isBusy();
+
+private:
+	static Solution solveRobust(const Request& request);
+	static Solution solveAutoModel(const Request& request);
+	static int countParameters(int flags);
+
+	void work();
+
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool stopping, hasRequest, hasSolution, solving;
+	unsigned int generation;
+	unsigned int requestCount, pendingRequestId;
+	Request pendingRequest;
+	Solution newestSolution;
+};
@@ -0,0 +1,107 @@
+#include "ofMain.h"
+#include "ofxOpenCv.h"
+#include "LensDistortion.h"
+#include "CalibrationFile.h"
+
+// checks the cpu lens models against opencv and the calibration file checksum
+// against zlib's. runs without a window and exits with the number of failed
+// checks, so it can be used from scripts.
+
+static int failures = 0;
+
+static void check(bool condition, const string& description) {
+	if (!condition) {
+		ofLogError("tests") << "failed: " << description;
+		failures++;
+	}
+}
+
+// LensDistortion::distort() has to match cv::projectPoints for every model, both
+// through the template and the runtime dispatch
+static void testDistortMatchesProjectPoints(const string& name, LensDistortion::Model expectedModel, ofVec3f radial, ofVec2f tangential) {
+	const int width = 1280, height = 720;
+	ofVec2f focalLength(1100, 1080), principalPoint(650, 350);
+	LensDistortion distortion;
+	distortion.setup(radial, tangential, focalLength, principalPoint);
+	check(distortion.getModel() == expectedModel, name + " picks the expected model");
+
+	// points on a grid over the image, as normalized lens coordinates at z = 1, so
+	// projectPoints with an identity pose maps them through the lens model only
+	vector<ofVec2f> pixels;
+	vector<cv::Point3f> objectPoints;
+	for (int y = 0; y <= height; y += 40) {
+		for (int x = 0; x <= width; x += 40) {
+			pixels.push_back(ofVec2f(x, y));
+			objectPoints.push_back(cv::Point3f((x - principalPoint.x) / focalLength.x, (y - principalPoint.y) / focalLength.y, 1));
+		}
+	}
+	cv::Mat1d cameraMatrix = (cv::Mat1d(3, 3) <<
+		focalLength.x, 0, principalPoint.x,
+		0, focalLength.y, principalPoint.y,
+		0, 0, 1);
+	cv::Mat1d distortionCoefficients = (cv::Mat1d(1, 5) << radial.x, radial.y, tangential.x, tangential.y, radial.z);
+	cv::Mat1d rvec = cv::Mat1d::zeros(3, 1), tvec = cv::Mat1d::zeros(3, 1);
+	vector<cv::Point2f> imagePoints;
+	cv::projectPoints(objectPoints, rvec, tvec, cameraMatrix, distortionCoefficients, imagePoints);
+
+	// float against double, at up to a few thousand pixels
+	const float tolerance = .01;
+	float worst = 0;
+	for (unsigned int i = 0; i < pixels.size(); i++) {
+		ofVec2f expected(imagePoints[i].x, imagePoints[i].y);
+		ofVec2f dispatched = distortion.distort(pixels[i]);
+		ofVec2f specialized;
+		switch (expectedModel) {
+			case LensDistortion::MODEL_NONE: specialized = distortion.distort<LensDistortion::MODEL_NONE>(pixels[i]); break;
+			case LensDistortion::MODEL_K1: specialized = distortion.distort<LensDistortion::MODEL_K1>(pixels[i]); break;
+			case LensDistortion::MODEL_RADIAL: specialized = distortion.distort<LensDistortion::MODEL_RADIAL>(pixels[i]); break;
+			case LensDistortion::MODEL_FULL: specialized = distortion.distort<LensDistortion::MODEL_FULL>(pixels[i]); break;
+		}
+		worst = MAX(worst, MAX(dispatched.distance(expected), specialized.distance(expected)));
+	}
+	check(worst < tolerance, name + " matches cv::projectPoints within " + ofToString(tolerance) + " px, worst " + ofToString(worst));
+	ofLogNotice("tests") << name << ": worst difference " << worst << " px";
+}
+
+// CalibrationFile::crc32() works on 8 bytes at a time, it has to give zlib's crc
+// for every length and alignment, and when continued over several calls
+static void testCrc32() {
+	const string digits = "123456789";
+	check(CalibrationFile::crc32(digits.data(), digits.size()) == 0xCBF43926, "crc32 of 123456789 is zlib's check value");
+
+	ofSeedRandom(0);
+	vector<unsigned char> bytes(1000);
+	for (auto& byte : bytes) {
+		byte = ofRandom(256);
+	}
+	bool matches = true;
+	for (unsigned int begin = 0; begin < 8; begin++) {
+		for (unsigned int size = 0; begin + size <= bytes.size(); size += 37) {
+			uint32_t whole = CalibrationFile::crc32(&bytes[begin], size);
+			unsigned int split = size / 3;
+			uint32_t continued = CalibrationFile::crc32(&bytes[begin + split], size - split, CalibrationFile::crc32(&bytes[begin], split));
+			uint32_t bytewise = 0;
+			for (unsigned int i = 0; i < size; i++) {
+				bytewise = CalibrationFile::crc32(&bytes[begin + i], 1, bytewise);
+			}
+			matches = matches && whole == continued && whole == bytewise;
+		}
+	}
+	check(matches, "crc32 is the same in one call, in two and byte by byte");
+}
+
+int main() {
+	testDistortMatchesProjectPoints("no distortion", LensDistortion::MODEL_NONE, ofVec3f(0, 0, 0), ofVec2f(0, 0));
+	testDistortMatchesProjectPoints("k1", LensDistortion::MODEL_K1, ofVec3f(-.2, 0, 0), ofVec2f(0, 0));
+	testDistortMatchesProjectPoints("k1 k2 k3", LensDistortion::MODEL_RADIAL, ofVec3f(-.15, .05, -.01), ofVec2f(0, 0));
+	testDistortMatchesProjectPoints("k1 k2 k3 p1 p2", LensDistortion::MODEL_FULL, ofVec3f(-.15, .05, -.01), ofVec2f(.001, -.002));
+	testDistortMatchesProjectPoints("p1 p2", LensDistortion::MODEL_FULL, ofVec3f(0, 0, 0), ofVec2f(.003, .002));
+	testCrc32();
+
+	if (failures > 0) {
+		ofLogError("tests") << failures << " checks failed";
+	} else {
+		ofLogNotice("tests") << "all checks passed";
+	}
+	return failures;
+}